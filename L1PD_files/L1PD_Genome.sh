@@ -48,7 +48,8 @@ dir_path=$(dirname $0)
 if [ ! -f $file.index ] ; then
 	mrfast --index $file
 fi
-mrfast --search $file --seq $PROBESFASTA -e $edit_distance -o probes_$prefix.sam
+# L1PD.py only keeps hits on chr1..chr22, chrX and chrY; skip the other contigs
+mrfast --search $file --seq $PROBESFASTA -e $edit_distance --contig-regex '^.{1,5}$' -o probes_$prefix.sam
 
 # Apply the L1PD algorithm to generate GFF3 and histogram
 $dir_path/L1PD.py probes_$prefix.sam $PROBESFASTA -t $dist_threshold -m $min_amt_kmers --data_dir $meta_data > $prefix.gff3
@@ -49,12 +49,19 @@
 #include <getopt.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
 #include "Common.h"
 #include "CommandLineParser.h"
 
 int				uniqueMode=1;
 int				indexingMode;
+int				indexAppendMode;
 int				searchingMode;
+int				indexStatsMode;
+int				indexStatsTop = 20;
+int				indexPatchMode;
+char				*patchVcf = NULL;
+char				*patchName = NULL;
 int				pairedEndMode;
 int				pairedEndModeMP;
 int				pairedEndModePE;
@@ -63,8 +70,26 @@ int				transChromosomal=0;
 int				pairedEndProfilingMode;
 int				seqCompressed;
 int				outCompressed;
+int				indexCompressed;
+int				indexPackedRef;
+int				indexFM;
+int				indexMinimizer = 0;
+int				indexPrefetch = 1;
+int				indexHugePages = 0;
+unsigned long			numaNodeMask = 0;
+int				seedCnt = 0;
+unsigned int			seedMask[MAX_SEED_MASKS];
 int				cropSize = 0;
 int				progressRep = 0;
+int				threadCount = 1;
+int				maxKeyFrequency = 0;
+int				indexMemory = 0;
+char				*contigInclude = NULL;
+char				*contigExclude = NULL;
+char				*contigRegex = NULL;
+char				*serveSocket = NULL;
+char				*clientSocket = NULL;
+int				serveJob = 0;
 int				minPairEndedDistance=-1;
 int				maxPairEndedDistance=-1;
 int				minPairEndedDiscordantDistance=-1;
@@ -83,6 +108,8 @@ int 				maxDiscordantOutput=300;
 unsigned char			errThreshold=255;
 unsigned char			maxHits=0;
 unsigned char			WINDOW_SIZE = 12;
+unsigned char			windowSizes[MAX_WINDOW_SIZES];
+int				windowSizeCnt = 0;
 unsigned int			CONTIG_SIZE;
 unsigned int			CONTIG_MAX_SIZE;
 char                            readGroup[FILE_NAME_LENGTH];
@@ -91,12 +118,128 @@ char                            libName[FILE_NAME_LENGTH];
 
 void printHelp();
 
+// Comma separated masks of the same length and weight; 1 marks the bases
+// of a window that are part of its key. The window size is the mask length.
+int parseSeedMasks(char *masks)
+{
+  int len = 0, weight = 0, i;
+  char *p = masks;
+
+  for (seedCnt = 0; seedCnt < MAX_SEED_MASKS && *p; seedCnt++)
+    {
+      seedMask[seedCnt] = 0;
+      for (i = 0; p[i] == '0' || p[i] == '1'; i++)
+	if (i < 31 && p[i] == '1')
+	  seedMask[seedCnt] |= 1U << i;
+
+      if (seedCnt == 0)
+	{
+	  len = i;
+	  weight = __builtin_popcount(seedMask[0]);
+	}
+      if (i != len || i > 31 || (p[i] != ',' && p[i] != '\0')
+	  || __builtin_popcount(seedMask[seedCnt]) != weight)
+	break;
+
+      p += (p[i] == ',') ? i + 1 : i;
+    }
+
+  if (*p || weight < 8 || weight > 30)
+    {
+      fprintf(stderr, "ERROR: Use at most %d seed masks of the same length (max:31) with 8 to 30 ones\n", MAX_SEED_MASKS);
+      return 0;
+    }
+
+  WINDOW_SIZE = len;
+  return 1;
+}
+
+// Comma separated NUMA nodes or ranges of nodes like 0-1,3
+int parseNodeList(char *list, unsigned long *mask)
+{
+  char *p = list;
+  long from, to;
+
+  *mask = 0;
+  while (1)
+    {
+      if (*p < '0' || *p > '9')
+	return 0;
+      from = to = strtol(p, &p, 10);
+      if (*p == '-')
+	to = strtol(p+1, &p, 10);
+      if (to < from || to >= 8*sizeof(*mask))
+	return 0;
+      for (; from <= to; from++)
+	*mask |= 1UL << from;
+      if (*p != ',')
+	break;
+      p++;
+    }
+  return (*p == '\0' || *p == '\n');
+}
+
+// Comma separated window sizes; several of them are indexed in one pass
+int parseWindowSizes(char *sizes)
+{
+  char *p = sizes;
+  long size;
+
+  for (windowSizeCnt = 0; windowSizeCnt < MAX_WINDOW_SIZES; p++)
+    {
+      size = strtol(p, &p, 10);
+      if (size > 31 || size < 11)
+	{
+	  fprintf(stderr, "ERROR: Window size should be in [11..31]\n");
+	  return 0;
+	}
+      windowSizes[windowSizeCnt++] = size;
+      if (*p != ',')
+	break;
+    }
+
+  if (*p)
+    {
+      fprintf(stderr, "ERROR: Use at most %d comma separated window sizes\n", MAX_WINDOW_SIZES);
+      return 0;
+    }
+
+  WINDOW_SIZE = windowSizes[0];
+  return 1;
+}
+
+// interleave spreads the index buffers over all online NUMA nodes, a list of
+// nodes over the listed ones; a single node binds them to it
+int parseNumaNodes(char *nodes)
+{
+  unsigned long online = 1;
+  char buf[256];
+  FILE *fp = fopen("/sys/devices/system/node/online", "r");
+
+  if (fp != NULL)
+    {
+      if (fgets(buf, sizeof(buf), fp) == NULL || !parseNodeList(buf, &online))
+	online = 1;
+      fclose(fp);
+    }
+
+  if (strcmp(nodes, "interleave") == 0)
+    numaNodeMask = online;
+  else if (!parseNodeList(nodes, &numaNodeMask) || (numaNodeMask & ~online))
+    {
+      fprintf(stderr, "ERROR: --numa takes interleave or a comma separated list of online NUMA nodes\n");
+      return 0;
+    }
+  return 1;
+}
+
 int parseCommandLine (int argc, char *argv[])
 {
   
   int o;
   int index;
   char *fastaFile = NULL;
+  char *seedMasks = NULL;
 
   readGroup[0] = 0;
   sampleName[0] = 0;
@@ -111,11 +254,25 @@ int parseCommandLine (int argc, char *argv[])
       {"profile",       no_argument, 	    &pairedEndProfilingMode,	1},
       {"seqcomp",	no_argument,	    &seqCompressed,		1},
       {"outcomp",       no_argument,	    &outCompressed,		1},
+      {"idxcomp",       no_argument,	    &indexCompressed,		1},
+      {"packref",       no_argument,	    &indexPackedRef,		1},
+      {"fmindex",       no_argument,	    &indexFM,			1},
+      {"no-prefetch",   no_argument,	    &indexPrefetch,		0},
+      {"hugepages",     no_argument,	    &indexHugePages,		1},
+      {"numa",          required_argument,  0,			'N'},
+      {"serve",         required_argument,  0,			'L'},
+      {"client",        required_argument,  0,			'K'},
       {"progress",	no_argument,	    &progressRep,		1},
       {"best",		no_argument,	    &bestMode,		1},
       {"debug",		no_argument,	    &debugMode,		1},
       {"index",		required_argument,  0, 			'i'},
+      {"index-append",	required_argument,  0, 			'A'},
       {"search",	required_argument,  0,			's'},
+      {"index-stats",	required_argument,  0,			'I'},
+      {"top",		required_argument,  0,			'T'},
+      {"index-patch",	required_argument,  0,			'P'},
+      {"vcf",		required_argument,  0,			'V'},
+      {"patch-out",	required_argument,  0,			'O'},
       {"help",		no_argument,	    0,			'h'},
       {"version",	no_argument,	    0,			'v'},
       {"quiet",	        no_argument,	    0,			'q'},
@@ -131,6 +288,14 @@ int parseCommandLine (int argc, char *argv[])
       {"rg",            required_argument,  0,                  'g'},
       {"sample",        required_argument,  0,                  'p'},
       {"lib",           required_argument,  0,                  'r'},
+      {"threads",       required_argument,  0,                  't'},
+      {"maxfreq",       required_argument,  0,                  'f'},
+      {"index-mem",     required_argument,  0,                  'M'},
+      {"minimizer",     required_argument,  0,                  'W'},
+      {"seed",          required_argument,  0,                  'S'},
+      {"contigs",       required_argument,  0,                  'C'},
+      {"exclude-contigs", required_argument, 0,                 'E'},
+      {"contig-regex",  required_argument,  0,                  'R'},
       {"nosam",         no_argument,        &nosamMode,         1},
       {0,  0,  0, 0},
     };
@@ -140,8 +305,18 @@ int parseCommandLine (int argc, char *argv[])
     return 0;
   }
 
-  while ( (o = getopt_long ( argc, argv, "hvn:e:o:u:i:s:x:y:w:l:m:c:a:d:g:p:r:", longOptions, &index)) != -1 )
+  while ( (o = getopt_long ( argc, argv, "hvn:e:o:u:i:s:x:y:w:l:m:c:a:d:g:p:r:t:f:C:E:R:A:M:W:S:I:T:N:L:K:P:V:O:", longOptions, &index)) != -1 )
     {
+      // A job of the server searches the index the server keeps as it is
+      if (serveJob && ((o != 0 && strchr("wfMWSiAIPVONLK", o) != NULL) ||
+		       (o == 0 && (longOptions[index].flag == &indexCompressed || longOptions[index].flag == &indexPackedRef ||
+				   longOptions[index].flag == &indexFM || longOptions[index].flag == &indexPrefetch ||
+				   longOptions[index].flag == &indexHugePages))))
+	{
+	  fprintf(stderr, "ERROR: Options that change the index cannot be used in a job of the server\n");
+	  return 0;
+	}
+
       switch (o)
 	{
 	case 'a':
@@ -158,15 +333,72 @@ int parseCommandLine (int argc, char *argv[])
 	  indexingMode = 1;
 	  fastaFile = optarg;
 	  break;
+	case 'A':
+	  indexingMode = 1;
+	  indexAppendMode = 1;
+	  fastaFile = optarg;
+	  break;
 	case 's':
 	  searchingMode = 1;
 	  fastaFile = optarg;
 	  break;
+	case 'I':
+	  indexStatsMode = 1;
+	  fastaFile = optarg;
+	  break;
+	case 'T':
+	  indexStatsTop = atoi(optarg);
+	  break;
+	case 'P':
+	  indexPatchMode = 1;
+	  fastaFile = optarg;
+	  break;
+	case 'V':
+	  patchVcf = optarg;
+	  break;
+	case 'O':
+	  patchName = optarg;
+	  break;
 	case 'c': 
 	  cropSize = atoi(optarg);
 	  break;
 	case 'w':
-	  WINDOW_SIZE = atoi(optarg);
+	  if (!parseWindowSizes(optarg))
+	    return 0;
+	  break;
+	case 't':
+	  threadCount = atoi(optarg);
+	  break;
+	case 'f':
+	  maxKeyFrequency = atoi(optarg);
+	  break;
+	case 'M':
+	  indexMemory = atoi(optarg);
+	  break;
+	case 'W':
+	  indexMinimizer = atoi(optarg);
+	  break;
+	case 'S':
+	  seedMasks = optarg;
+	  break;
+	case 'N':
+	  if (!parseNumaNodes(optarg))
+	    return 0;
+	  break;
+	case 'L':
+	  serveSocket = optarg;
+	  break;
+	case 'K':
+	  clientSocket = optarg;
+	  break;
+	case 'C':
+	  contigInclude = optarg;
+	  break;
+	case 'E':
+	  contigExclude = optarg;
+	  break;
+	case 'R':
+	  contigRegex = optarg;
 	  break;
 	case 'x':
 	  seqFile1 = optarg;
@@ -223,19 +455,74 @@ int parseCommandLine (int argc, char *argv[])
 	}
 
     }
+
+  // The server checks the job
+  if (clientSocket != NULL)
+    return 1;
   
-  if (indexingMode + searchingMode != 1)
+  if (indexingMode + searchingMode + indexStatsMode + indexPatchMode != 1)
+    {
+      fprintf(stderr, "ERROR: Indexing / Searching / Index statistics / Index patching mode should be selected\n");
+      return 0;
+    }
+
+  if (serveSocket != NULL && !searchingMode)
     {
-      fprintf(stderr, "ERROR: Indexing / Searching mode should be selected\n");
+      fprintf(stderr, "ERROR: --serve should be used with --search\n");
       return 0;
     }
 
-  if (WINDOW_SIZE > 15 || WINDOW_SIZE < 11)
+  if (seedMasks != NULL && !parseSeedMasks(seedMasks))
+    return 0;
+
+  if (WINDOW_SIZE > 31 || WINDOW_SIZE < 11)
     {
-      fprintf(stderr, "ERROR: Window size should be in [12..15]\n");
+      fprintf(stderr, "ERROR: Window size should be in [11..31]\n");
       return 0;
     }
 
+  if (windowSizeCnt > 1 && (!indexingMode || indexAppendMode || indexFM || indexMemory || seedCnt))
+    {
+      fprintf(stderr, "ERROR: Several window sizes can only be given to --index, without --index-append, --fmindex, --index-mem or --seed\n");
+      return 0;
+    }
+
+
+  if (threadCount < 1)
+    {
+      fprintf(stderr, "ERROR: Number of threads should be at least 1\n");
+      return 0;
+    }
+
+  if (indexMemory < 0)
+    {
+      fprintf(stderr, "ERROR: Index memory should be positive (0: no limit)\n");
+      return 0;
+    }
+
+  if (maxKeyFrequency < 0)
+    {
+      fprintf(stderr, "ERROR: Maximum key frequency should be positive (0: no limit)\n");
+      return 0;
+    }
+
+  if (indexMinimizer < 0 || indexMinimizer > 64)
+    {
+      fprintf(stderr, "ERROR: Minimizer window should be in [1..64] (0: every key)\n");
+      return 0;
+    }
+
+  if (indexMinimizer && indexFM)
+    {
+      fprintf(stderr, "ERROR: Use either --minimizer or --fmindex, not both. \n");
+      return 0;
+    }
+
+  if (seedCnt && (indexMinimizer || indexFM))
+    {
+      fprintf(stderr, "ERROR: --seed cannot be used with --minimizer or --fmindex. \n");
+      return 0;
+    }
 
   if ( indexingMode )
     {
@@ -275,7 +562,7 @@ int parseCommandLine (int argc, char *argv[])
 	  return 0;
 	}
 
-      if (seqFile1 == NULL && seqFile2 == NULL)
+      if (seqFile1 == NULL && seqFile2 == NULL && serveSocket == NULL)
 	{
 	  fprintf(stderr, "ERROR: Please indicate a sequence file for searching.\n");
 	  return 0;
@@ -288,6 +575,12 @@ int parseCommandLine (int argc, char *argv[])
 	  return 0;
 	}
 
+      if (seqFile1 != NULL && seqFile2 != NULL && strcmp(seqFile1, "-") == 0 && strcmp(seqFile2, "-") == 0)
+	{
+	  fprintf(stderr, "ERROR: Only one of the sequence files can be read from the standard input.\n");
+	  return 0;
+	}
+
       if (pairedEndMode && (minPairEndedDistance <0 || maxPairEndedDistance < 0 || minPairEndedDistance > maxPairEndedDistance))
 	{
 	  fprintf(stderr, "ERROR: Please enter a valid range for pairedend sequences.\n");
@@ -341,8 +634,40 @@ int parseCommandLine (int argc, char *argv[])
 
     }
 
+  if ( indexStatsMode )
+    {
+      CONTIG_SIZE	= 330000000;
+      CONTIG_MAX_SIZE	= 330000000;
+
+      if (indexStatsTop < 0)
+	{
+	  fprintf(stderr, "ERROR: Number of heaviest keys should be positive\n");
+	  return 0;
+	}
+    }
+
+  if ( indexPatchMode && (patchVcf == NULL || patchName == NULL) )
+    {
+      fprintf(stderr, "ERROR: --index-patch needs a --vcf file and the --patch-out name\n");
+      return 0;
+    }
+
   sprintf(fileName[0], "%s", fastaFile);
   sprintf(fileName[1], "%s.index", fileName[0]); 
+
+  // An index of the window size built with a list of --ws sizes
+  if (searchingMode && windowSizeCnt == 1)
+    {
+      char name[FILE_NAME_LENGTH];
+
+      if (snprintf(name, FILE_NAME_LENGTH, "%s.ws%d.index", fileName[0], WINDOW_SIZE) < FILE_NAME_LENGTH
+	  && access(name, R_OK) == 0)
+	sprintf(fileName[1], "%s", name);
+    }
+
+  // The index itself can be given to --index-stats and --index-patch
+  if ((indexStatsMode || indexPatchMode) && strlen(fastaFile) > 6 && strcmp(fastaFile + strlen(fastaFile) - 6, ".index") == 0)
+    sprintf(fileName[1], "%s", fastaFile);
        
 
 
@@ -393,21 +718,36 @@ void printHelp()
   fprintf(stderr,"\n\n");
 
   fprintf(stderr,"Indexing Options:\n");
-  fprintf(stderr," --index [file]\t\tGenerate an index from the specified fasta file. \n");
-  fprintf(stderr," --ws [int]\t\tSet window size for indexing (default:12 max:14).\n");
+  fprintf(stderr," --index [file]\t\tGenerate an index from the specified fasta file. \n\t\t\tThe fasta file may be gzip or BGZF compressed.\n");
+  fprintf(stderr," --index-append [file]\tIndex the records of the fasta file that are not in its index yet and\n\t\t\tappend them. Window size and index options are taken from the index.\n");
+  fprintf(stderr," --ws [int]\t\tSet window size for indexing (default:12 max:31). A comma separated\n\t\t\tlist of sizes (max:%d) builds one [file].ws[int].index per size from a\n\t\t\tsingle pass over the reference; --search with --ws uses it.\n", MAX_WINDOW_SIZES);
+  fprintf(stderr," --threads [int]\tNumber of threads used for indexing and for BGZF \n\t\t\tdecompression of the reference (default:1).\n");
+  fprintf(stderr," --idxcomp \t\tCompress the location lists of the index (delta + group varint).\n");
+  fprintf(stderr," --packref \t\tStore the reference in the index with 2 bits per base. This\n\t\t\tshrinks the index file and its load I/O; searching unpacks\n\t\t\teach chunk into memory of its own, also for a shared index.\n");
+  fprintf(stderr," --fmindex \t\tStore an FM-index instead of the k-mer table. With --maxfreq, frequent\n\t\t\tkeys are extended to the left within the read until they are rare enough.\n");
+  fprintf(stderr," --index-mem [int]\tBuild the index out of core with sorted runs of at most this many MB\n\t\t\tspilled next to the index (default:0 in memory). The reference chunk\n\t\t\tbeing indexed comes on top.\n");
+  fprintf(stderr," --seed [masks]\tSpaced seed masks like 1101101101101, comma separated (max:4). Only the\n\t\t\tbases under a 1 form the key; the mask length sets the window size and\n\t\t\tconsecutive windows of a read cycle through the masks.\n");
+  fprintf(stderr," --minimizer [int]\tOnly index the minimizer of every [int] consecutive keys. Reads are\n\t\t\tsearched with their non-overlapping minimizers (default:0 every key).\n");
+  fprintf(stderr," --maxfreq [int]\tKeys with more locations are moved to an overflow table and only\n\t\t\tused for reads without other keys (default:0 no limit, search: index value).\n");
   fprintf(stderr,"\n\n");
 
   fprintf(stderr,"Searching Options:\n");
   fprintf(stderr," --search [file]\tSearch in the specified genome. Provide the path to the fasta file. \n\t\t\tIndex file should be in the same directory.\n");
   fprintf(stderr," --pe \t\t\tSearch will be done in Paired-End mode.\n");
-  fprintf(stderr," --seq [file]\t\tInput sequences in fasta/fastq format [file]. If \n\t\t\tpaired end reads are interleaved, use this option.\n");
+  fprintf(stderr," --seq [file]\t\tInput sequences in fasta/fastq format [file]. If \n\t\t\tpaired end reads are interleaved, use this option.\n\t\t\tA [file] of - reads the standard input.\n");
   fprintf(stderr," --seq1 [file]\t\tInput sequences in fasta/fastq format [file] (First \n\t\t\tfile). Use this option to indicate the first file of \n\t\t\tpaired end reads. \n");
   fprintf(stderr," --seq2 [file]\t\tInput sequences in fasta/fastq format [file] (Second \n\t\t\tfile). Use this option to indicate the second file of \n\t\t\tpaired end reads.  \n");
   fprintf(stderr," -o [file]\t\tOutput of the mapped sequences. The default is \"output\".\n");
   fprintf(stderr," -u [file]\t\tSave unmapped sequences in fasta/fastq format.\n");
   fprintf(stderr," --best   \t\tOnly the best mapping from all the possible mapping is returned.\n");
+  fprintf(stderr," --contigs [list]\tOnly search the contigs in the comma separated list.\n");
+  fprintf(stderr," --exclude-contigs [list]\n\t\t\tDo not search the contigs in the comma separated list.\n");
+  fprintf(stderr," --contig-regex [regex]\n\t\t\tOnly search the contigs whose name matches the extended regex.\n");
   fprintf(stderr," --seqcomp \t\tIndicates that the input sequences are compressed (gz).\n");
   fprintf(stderr," --outcomp \t\tIndicates that output file should be compressed (gz).\n");
+  fprintf(stderr," --hugepages \t\tBack the hash table, the index chunks and the reference with 2MB\n\t\t\thugepages (reserved ones if available, transparent otherwise).\n");
+  fprintf(stderr," --numa [nodes]\t\tInterleave the same buffers over the comma separated NUMA nodes,\n\t\t\tbind them to a single node or use interleave for all nodes.\n\t\t\tWith either option the reference, keys and starts of the current\n\t\t\tand the prefetched chunk are copied out of the index, on top of\n\t\t\tthe mapped index; location lists stay mapped.\n");
+  fprintf(stderr," --no-prefetch \t\tDo not prepare the next index chunk while the current one is searched.\n\t\t\tSaves the decode buffers of a second chunk for compressed indexes.\n");
   fprintf(stderr," -e [int]\t\tMaximum allowed %s (default 4%% of the read length).\n", errorType);
   fprintf(stderr," --min [int]\t\tMin distance allowed between a pair of end sequences.\n");
   fprintf(stderr," --max [int]\t\tMax distance allowed between a pair of end sequences.\n");
@@ -418,4 +758,21 @@ void printHelp()
   fprintf(stderr," --rg [string]\t\tRead group ID to be added to the SAM header (optional).\n");
   fprintf(stderr," --lib [string]\t\tLibrary name to be added to the SAM header (optional).\n");
   fprintf(stderr,"\n\n");
+
+  fprintf(stderr,"Server Options:\n");
+  fprintf(stderr," --serve [socket]\tWith --search, load the index once and run the search jobs sent to\n\t\t\tthe Unix socket against it. Each job runs in a forked process.\n\t\t\tChunks of compressed indexes are kept decoded.\n");
+  fprintf(stderr," --client [socket]\tSend the other searching options as a job to the server listening on\n\t\t\tthe socket (no --search) and print its report.\n");
+  fprintf(stderr,"\n\n");
+
+  fprintf(stderr,"Index Patching Options:\n");
+  fprintf(stderr," --index-patch [file]\tWrite the index of the consensus of the fasta file (or of the given\n\t\t\t.index) and the variants of a normalized VCF without rebuilding it.\n\t\t\tOnly the windows over a variant are hashed again.\n");
+  fprintf(stderr," --vcf [file]\t\tVariants to apply (vcf or vcf.gz); the first ALT of every record is used.\n");
+  fprintf(stderr," --patch-out [file]\tName of the consensus fasta; its index is written to [file].index.\n");
+  fprintf(stderr,"\n\n");
+
+  fprintf(stderr,"Index Statistics Options:\n");
+  fprintf(stderr," --index-stats [file]\tPrint the chunks, contigs, key size histogram and heaviest keys of\n\t\t\tthe index of the fasta file (or of the given .index) to stdout.\n");
+  fprintf(stderr," --top [int]\t\tNumber of heaviest keys reported (default:20).\n");
+  fprintf(stderr," --seq [file]\t\tAlso report the candidates every window of these probes looks up.\n");
+  fprintf(stderr,"\n\n");
 }
@@ -48,8 +48,17 @@
 #include <sys/time.h>
 #include <zlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include "Common.h"
 
+#define LARGE_MEM_PAGE		(2*1024*1024)
+#ifndef MPOL_BIND
+#define MPOL_BIND		2
+#define MPOL_INTERLEAVE		3
+#endif
+
 
 unsigned short 			SEQ_LENGTH = 0;
 long long		       	memUsage = 0;
@@ -149,6 +158,64 @@ void freeMem(void *ptr, size_t size)
   free(ptr);
 }
 /**********************************************/
+// Size of the mapping behind a large buffer
+size_t getLargeMemSize(size_t size)
+{
+  return (size + LARGE_MEM_PAGE - 1) & ~(size_t)(LARGE_MEM_PAGE - 1);
+}
+/**********************************************/
+// The big buffers of a loaded index get a mapping of their own so that they
+// can be backed by hugepages (--hugepages) and placed on NUMA nodes (--numa)
+void *getLargeMem(size_t size)
+{
+  static int hugeWarned = 0, numaWarned = 0;
+  size_t len = getLargeMemSize(size);
+  void *ret = MAP_FAILED;
+  int mode = (__builtin_popcountl(numaNodeMask) > 1) ? MPOL_INTERLEAVE : MPOL_BIND;
+
+  if (!indexHugePages && !numaNodeMask)
+    return getMem(size);
+
+#ifdef MAP_HUGETLB
+  if (indexHugePages)
+    ret = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+  if (ret == MAP_FAILED)
+    {
+      ret = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (ret == MAP_FAILED)
+	{
+	  fprintf(stderr, "Cannot allocate memory. Currently addressed memory = %0.2f MB, requested memory = %0.2f MB.\nCheck the available main memory, and if you have user limits (ulimit -v).\n", getMemUsage(), (float)(size/1048576.0));
+	  exit(0);
+	}
+      if (indexHugePages && madvise(ret, len, MADV_HUGEPAGE) != 0 && !hugeWarned)
+	{
+	  fprintf(stderr, "Warning: Hugepages are not available, using normal pages.\n");
+	  hugeWarned = 1;
+	}
+    }
+
+  if (numaNodeMask && syscall(SYS_mbind, ret, len, mode, &numaNodeMask, 8*sizeof(numaNodeMask)+1, 0) != 0 && !numaWarned)
+    {
+      fprintf(stderr, "Warning: Cannot place the index on the selected NUMA nodes.\n");
+      numaWarned = 1;
+    }
+
+  memUsage+=size;
+  return ret;
+}
+/**********************************************/
+void freeLargeMem(void *ptr, size_t size)
+{
+  if (!indexHugePages && !numaNodeMask)
+    {
+      freeMem(ptr, size);
+      return;
+    }
+  memUsage-=size;
+  munmap(ptr, getLargeMemSize(size));
+}
+/**********************************************/
 double getMemUsage()
 {
   return memUsage/1048576.0;
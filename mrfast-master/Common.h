@@ -56,12 +56,16 @@
 #define MAX_OPEN_FILE		600		
 #define MAX_TRANS_CHROMOSAL_OUTPUT 50
 #define MAX_OEA_OUT		500
+#define MAX_SEED_MASKS		4			// Spaced seed masks of an index
+#define MAX_WINDOW_SIZES	8			// Window sizes indexed in one pass
 
 extern unsigned int		CONTIG_SIZE;
 extern unsigned int		CONTIG_MAX_SIZE;
 
 
 extern unsigned char	WINDOW_SIZE;		// WINDOW SIZE for indexing/searching
+extern unsigned char	windowSizes[MAX_WINDOW_SIZES];	// --ws list
+extern int		windowSizeCnt;
 extern unsigned short	SEQ_LENGTH;		// Sequence(read) length
 
 extern char				*versionNumber;
@@ -73,7 +77,13 @@ extern int				maxOEAOutput;
 extern int				maxDiscordantOutput;
 extern int				uniqueMode;
 extern int				indexingMode;
+extern int				indexAppendMode;
 extern int				searchingMode;
+extern int				indexStatsMode;
+extern int				indexStatsTop;
+extern int				indexPatchMode;
+extern char				*patchVcf;
+extern char				*patchName;
 extern int				pairedEndModeMP;
 extern int				pairedEndModePE;
 extern int				pairedEndMode;
@@ -85,8 +95,26 @@ extern int				nosamMode;
 extern int              debugMode;
 extern int				seqCompressed;
 extern int				outCompressed;
+extern int				indexCompressed;
+extern int				indexPackedRef;
+extern int				indexFM;
+extern int				indexMinimizer;
+extern int				indexPrefetch;
+extern int				indexHugePages;
+extern unsigned long			numaNodeMask;
+extern int				seedCnt;
+extern unsigned int		seedMask[MAX_SEED_MASKS];
 extern int				cropSize;
 extern int				progressRep;
+extern int				threadCount;
+extern int				maxKeyFrequency;
+extern int				indexMemory;
+extern char				*contigInclude;
+extern char				*contigExclude;
+extern char				*contigRegex;
+extern char				*serveSocket;
+extern char				*clientSocket;
+extern int				serveJob;		// Set in the searches forked for the jobs of --serve
 extern char 			*seqFile1;
 extern char				*seqFile2;
 extern char				*seqUnmapped;
@@ -114,6 +142,8 @@ void	reverseComplement (char *seq, char *rcSeq , int length);
 void	* getMem(size_t size);
 void    reMem(void *, size_t, size_t);
 void	freeMem(void * ptr, size_t size);
+void	*getLargeMem(size_t size);
+void	freeLargeMem(void *ptr, size_t size);
 double	getMemUsage();
 void 	reverse (char *seq, char *rcSeq , int length);
 void 	stripPath(char *full, char **path, char **fileName);
@@ -46,7 +46,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <regex.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
 #include "Common.h"
 #include "RefGenome.h"
 #include "HashTable.h"
@@ -58,39 +66,262 @@ char		*_ih_refGen		= NULL;
 char		*_ih_refGenName		= NULL;
 long long	_ih_memUsage		= 0;
 int		_ih_refGenOff		= 0;
+
+unsigned char	*_ih_map		= NULL;		// Mapped flat index
+size_t		_ih_mapSize		= 0;
+unsigned char	*_ih_residentMap	= NULL;		// Mapping kept by --serve for its jobs
+size_t		_ih_residentMapSize	= 0;
+char		_ih_residentPath[PATH_MAX];		// Real path of the index --serve keeps
+IndexChunk	*_ih_chunks		= NULL;
+unsigned int	_ih_chunkCnt		= 0;
+unsigned int	_ih_chunkCapacity	= 0;
+unsigned int	_ih_appendChunkCnt	= 0;		// Chunks already in the index (--index-append)
+int		_ih_curChunk		= -1;
+unsigned int	*_ih_curKeys		= NULL;
+char		*_ih_curRef		= NULL;
+unsigned int	_ih_unpack[256];			// Four bases of a packed byte
+unsigned short	_ih_flags		= 0;
+
+// A chunk of a flat index made ready for mapping: its reference unpacked and
+// its location lists decoded. The chunk after the current one is prepared in
+// the other slot by the prefetch thread.
+typedef struct
+{
+  int		chunk;				// Chunk held by the slot, -1 if none
+  unsigned char	*base;				// Data of the chunk, mapped or copied
+  unsigned char	*copyBuf;			// Copy of the chunk with --hugepages / --numa
+  unsigned long long copyBufSize;
+  unsigned long long copyBytes;
+  char		*ref;
+  char		*refBuf;			// Unpacked reference of a packed chunk
+  unsigned int	refBufSize;
+  unsigned int	*locBuf;			// Decoded locations of a compressed chunk
+  unsigned int	locBufSize;
+  unsigned int	*keys;				// Decoded keys of a compressed chunk
+  unsigned int	*starts;			// Decoded starts of a compressed chunk
+  unsigned int	*locs;				// Location area of an uncompressed chunk
+} IHashTableSlot;
+
+IHashTableSlot	_ih_slots[2];
+IHashTableSlot	*_ih_residentSlots	= NULL;		// Every chunk, prepared once by --serve
+int		_ih_slot		= 0;		// Slot of the current chunk
+pthread_t	_ih_prefetchThread;
+int		_ih_prefetching		= 0;
+
+unsigned long long *_ih_curKeys64	= NULL;		// Sorted keys of the current chunk (64-bit key layout)
+unsigned int	*_ih_curStarts		= NULL;
+unsigned int	*_ih_curLocs		= NULL;
+unsigned int	_ih_keyPrefix[(1<<16)+1];		// First key of every 16 bit key prefix
+int		_ih_keyPrefixShift	= 0;
+
+unsigned long long *_ih_ovKeys		= NULL;		// Overflow table of the current chunk
+unsigned int	*_ih_ovStarts		= NULL;
+unsigned int	*_ih_ovLocs		= NULL;
+unsigned int	_ih_ovKeyCnt		= 0;
+
+regex_t		_ih_contigRegex;			// Compiled --contig-regex
+
+unsigned char	_ih_gvLength[256];			// Data bytes of a group varint block
+unsigned char	_ih_gvShuffle[256][16];
+unsigned char	*(*decodeGroupVarint)(unsigned char *in, unsigned int *out, unsigned int n);
 /**********************************************/
 
-int hashVal(char *seq)
+#define IH_ALIGN(x)	(((x) + 7) & ~7ULL)
+#define IH_KEYS64	(WINDOW_SIZE > 15 || indexMinimizer || seedCnt)
+#define IH_REF_PADDING	SEQ_MAX_LENGTH		// Zeros behind an unpacked reference
+
+// 2-bit code of every character, -1 for anything else than ACGT
+signed char	_ih_code[256]		= { [0 ... 255] = -1, ['A'] = 0, ['C'] = 1, ['G'] = 2, ['T'] = 3 };
+
+long long hashVal(char *seq)
 {
-  int i=0;
-  int val=0, numericVal=0;
-
-  while(i<WINDOW_SIZE)
-    {
-      switch (seq[i])
-	{
-	case 'A':
-	  numericVal = 0;
-	  break;
-	case 'C':
-	  numericVal = 1;
-	  break;
-	case 'G' :
-	  numericVal = 2;
-	  break;
-	case 'T':
-	  numericVal = 3;
-	  break;
-	default:
-	  return -1;
-	  break;
-	}
-      val = (val << 2)|numericVal;
-      i++;
+  int i, code;
+  long long val=0;
+
+  if (seedCnt)
+    return hashSeedVal(seq, 0);
+
+  for (i=0; i<WINDOW_SIZE; i++)
+    {
+      code = _ih_code[(unsigned char)seq[i]];
+      if (code < 0)
+	return -1;
+      val = (val << 2) | code;
     }
   return val;
 }
+/**********************************************/
+// Key of the window-th window of a read; consecutive windows cycle through
+// the spaced seed masks
+long long hashSeedVal(char *seq, int window)
+{
+  int i, code, seed;
+  long long val=0;
+
+  if (!seedCnt)
+    return hashVal(seq);
+
+  seed = window % seedCnt;
+  for (i=0; i<WINDOW_SIZE; i++)
+    {
+      if (!(seedMask[seed] & (1U << i)))
+	continue;
+      code = _ih_code[(unsigned char)seq[i]];
+      if (code < 0)
+	return -1;
+      val = (val << 2) | code;
+    }
+  return val | ((long long)seed << (2*__builtin_popcount(seedMask[0])));
+}
+/**********************************************/
+// Number of significant bits of the keys
+int getIHashKeyBits()
+{
+  if (!seedCnt)
+    return 2*WINDOW_SIZE;
+  return 2*__builtin_popcount(seedMask[0]) + ((seedCnt > 1) ? 2 : 0);
+}
+/**********************************************/
+// Rolling encoder for the index build: every base is shifted in once and
+// a run of anything else than ACGT restarts the window
+typedef struct
+{
+  long long	val;
+  long long	mask;
+  int		len;			// Bases since the last restart
+} IHashRoller;
+
+static inline void initIHashRoller(IHashRoller *r)
+{
+  r->val = 0;
+  r->mask = (1LL << (2*WINDOW_SIZE)) - 1;
+  r->len = 0;
+}
+
+// Returns the value of the window ending at c, i.e. hashVal(&c - WINDOW_SIZE + 1)
+static inline long long rollIHashVal(IHashRoller *r, char c)
+{
+  int code = _ih_code[(unsigned char)c];
+
+  if (code < 0)
+    {
+      r->len = 0;
+      return -1;
+    }
+  r->val = ((r->val << 2) | code) & r->mask;
+  if (r->len < WINDOW_SIZE)
+    r->len++;
+  return (r->len == WINDOW_SIZE) ? r->val : -1;
+}
+/**********************************************/
+// Minimizer of the last indexMinimizer keys of a run of consecutive
+// locations: the leftmost key with the smallest order. With partial set,
+// windows at the start of a run that are not full yet also select a key.
+typedef struct
+{
+  unsigned long long	order[INDEX_MAX_MINIMIZER];
+  unsigned long long	key[INDEX_MAX_MINIMIZER];
+  unsigned int		loc[INDEX_MAX_MINIMIZER];
+  unsigned long long	mask;
+  unsigned int		prevLoc;
+  unsigned int		lastLoc;		// Location of the last selected key
+  int			cnt;			// Keys since the start of the run
+  int			min;
+  int			partial;
+} IHashMinimizer;
+
+// Invertible mix of the key so that low complexity keys like poly-A are not
+// always the minimizers
+static inline unsigned long long orderIHashMinimizer(unsigned long long key, unsigned long long mask)
+{
+  key = (~key + (key << 21)) & mask;
+  key = key ^ (key >> 24);
+  key = ((key + (key << 3)) + (key << 8)) & mask;
+  key = key ^ (key >> 14);
+  key = ((key + (key << 2)) + (key << 4)) & mask;
+  key = key ^ (key >> 28);
+  key = (key + (key << 31)) & mask;
+  return key;
+}
+
+static inline void initIHashMinimizer(IHashMinimizer *m, int partial)
+{
+  m->mask = (1ULL << (2*WINDOW_SIZE)) - 1;
+  m->prevLoc = m->lastLoc = 0;
+  m->cnt = m->min = 0;
+  m->partial = partial;
+}
+
+// Adds the key at loc; returns 1 and the minimizer when a new one is selected
+static inline int pushIHashMinimizer(IHashMinimizer *m, unsigned long long key, unsigned int loc, unsigned long long *minKey, unsigned int *minLoc)
+{
+  int w = indexMinimizer;
+  int slot, expired, i, j, n;
+
+  if (m->cnt > 0 && loc != m->prevLoc + 1)
+    m->cnt = 0;
+  m->prevLoc = loc;
+
+  slot = m->cnt % w;
+  expired = (m->cnt >= w && m->min == slot);
+  m->order[slot] = orderIHashMinimizer(key, m->mask);
+  m->key[slot] = key;
+  m->loc[slot] = loc;
+  m->cnt++;
+
+  if (m->cnt == 1)
+    m->min = slot;
+  else if (expired)
+    {
+      n = (m->cnt < w) ? m->cnt : w;
+      m->min = (m->cnt - n) % w;
+      for (i=1; i<n; i++)
+	{
+	  j = (m->cnt - n + i) % w;
+	  if (m->order[j] < m->order[m->min])
+	    m->min = j;
+	}
+    }
+  else if (m->order[slot] < m->order[m->min])
+    m->min = slot;
+
+  if ((m->cnt < w && !m->partial) || m->loc[m->min] == m->lastLoc)
+    return 0;
+  m->lastLoc = m->loc[m->min];
+  *minKey = m->key[m->min];
+  *minLoc = m->loc[m->min];
+  return 1;
+}
+/**********************************************/
+// Read offsets of the keys looked up for seq: every WINDOW_SIZE bases, or
+// the non-overlapping minimizers of the read for minimizer indexes
+int getSeedOffsets(char *seq, int length, int *offsets)
+{
+  IHashRoller		roller;
+  IHashMinimizer	mz;
+  unsigned long long	key;
+  unsigned int		loc;
+  long long		hv;
+  int			i, n = 0;
+
+  if (!indexMinimizer)
+    {
+      for (i=0; i + WINDOW_SIZE <= length; i += WINDOW_SIZE)
+	offsets[n++] = i;
+      return n;
+    }
 
+  initIHashRoller(&roller);
+  initIHashMinimizer(&mz, 0);
+  for (i=0; i<length; i++)
+    {
+      hv = rollIHashVal(&roller, seq[i]);
+      if (hv != -1 && pushIHashMinimizer(&mz, hv, i - WINDOW_SIZE + 2, &key, &loc)
+	  && (n == 0 || loc - 1 >= offsets[n-1] + WINDOW_SIZE))
+	offsets[n++] = loc - 1;
+    }
+  return n;
+}
 
 /**********************************************/
 void freeIHashTableContent(IHashTable *hashTable, unsigned int maxSize)
@@ -106,128 +337,2455 @@ void freeIHashTableContent(IHashTable *hashTable, unsigned int maxSize)
     }
 }
 /**********************************************/
+// Location lists are coded as gaps in groups of four. Each group starts with
+// a tag holding the byte length - 1 of every gap in two bits, followed by the
+// little-endian gap bytes. The first gap is taken from prev.
+unsigned char *encodeGroupVarintFrom(unsigned int *in, unsigned int n, unsigned char *out, unsigned int prev)
+{
+  unsigned int i, j, gap;
+  unsigned char *tag;
+
+  for (i=0; i<n; i+=4)
+    {
+      tag = out++;
+      *tag = 0;
+      for (j=0; j<4; j++)
+	{
+	  gap = (i+j < n) ? in[i+j] - prev : 0;
+	  if (i+j < n)
+	    prev = in[i+j];
+	  int len = (gap > 0xFFFFFF) ? 4 : (gap > 0xFFFF) ? 3 : (gap > 0xFF) ? 2 : 1;
+	  *tag |= (len-1) << (2*j);
+	  memcpy(out, &gap, len);
+	  out += len;
+	}
+    }
+  return out;
+}
+/**********************************************/
+unsigned char *encodeGroupVarint(unsigned int *in, unsigned int n, unsigned char *out)
+{
+  return encodeGroupVarintFrom(in, n, out, 0);
+}
+/**********************************************/
+// Both decoders write a multiple of four values
+unsigned char *decodeGroupVarintScalar(unsigned char *in, unsigned int *out, unsigned int n)
+{
+  unsigned int i, j, gap, prev = 0;
+  unsigned char tag;
+
+  for (i=0; i<n; i+=4)
+    {
+      tag = *in++;
+      for (j=0; j<4; j++)
+	{
+	  int len = ((tag >> (2*j)) & 3) + 1;
+	  gap = 0;
+	  memcpy(&gap, in, len);
+	  in += len;
+	  prev += gap;
+	  out[i+j] = prev;
+	}
+    }
+  return in;
+}
+/**********************************************/
+__attribute__((target("ssse3")))
+unsigned char *decodeGroupVarintSSSE3(unsigned char *in, unsigned int *out, unsigned int n)
+{
+  unsigned int i;
+  unsigned char tag;
+  __m128i gaps, prev = _mm_setzero_si128();
+
+  for (i=0; i<n; i+=4)
+    {
+      tag = *in;
+      gaps = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(in+1)), _mm_loadu_si128((__m128i *)_ih_gvShuffle[tag]));
+      gaps = _mm_add_epi32(gaps, _mm_slli_si128(gaps, 4));
+      gaps = _mm_add_epi32(gaps, _mm_slli_si128(gaps, 8));
+      gaps = _mm_add_epi32(gaps, prev);
+      _mm_storeu_si128((__m128i *)(out+i), gaps);
+      prev = _mm_shuffle_epi32(gaps, 0xFF);
+      in += 1 + _ih_gvLength[tag];
+    }
+  return in;
+}
+/**********************************************/
+void initGroupVarint()
+{
+  int tag, j, b, pos;
+
+  for (tag=0; tag<256; tag++)
+    {
+      pos = 0;
+      for (j=0; j<4; j++)
+	{
+	  int len = ((tag >> (2*j)) & 3) + 1;
+	  for (b=0; b<4; b++)
+	    _ih_gvShuffle[tag][4*j+b] = (b < len) ? pos+b : 0x80;
+	  pos += len;
+	}
+      _ih_gvLength[tag] = pos;
+    }
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3"))
+    decodeGroupVarint = &decodeGroupVarintSSSE3;
+  else
+    decodeGroupVarint = &decodeGroupVarintScalar;
+}
+/**********************************************/
+void writeIHashTablePadding()
+{
+  char zero[8] = {0};
+  long long pos = ftello(_ih_fp);
+
+  if (IH_ALIGN(pos) != pos && fwrite(zero, 1, IH_ALIGN(pos) - pos, _ih_fp) == 0)
+    fprintf(stderr, "Write error while saving hash table.\n");
+}
+/**********************************************/
+// Settings of an index that new contigs are appended to
+int initAppendingHashTable(char *fileName)
+{
+  IndexHeader header;
+  FILE *fp = fileOpen(fileName, "r");
+
+  if (fread(&header, sizeof(header), 1, fp) != 1 || header.type != INDEX_TYPE_FLAT)
+    {
+      fprintf(stderr, "Error: Only indexes generated by this version can be appended to.\n");
+      fclose(fp);
+      return 0;
+    }
+  fclose(fp);
+
+  WINDOW_SIZE = header.windowSize;
+  indexCompressed = (header.flags & INDEX_FLAG_COMPRESSED) ? 1 : 0;
+  indexPackedRef = (header.flags & INDEX_FLAG_PACKED_REF) ? 1 : 0;
+  indexFM = (header.flags & INDEX_FLAG_FM) ? 1 : 0;
+  indexMinimizer = (header.flags & INDEX_FLAG_MINIMIZER) ? header.minimizerWindow : 0;
+  seedCnt = (header.flags & INDEX_FLAG_SPACED) ? header.seedCnt : 0;
+  memcpy(seedMask, header.seedMask, sizeof(seedMask));
+  maxKeyFrequency = header.maxFreq;
+  return 1;
+}
+/**********************************************/
+// The chunk table is read back and the new chunks go to the end of the file,
+// behind it; until finalizeSavingIHashTable rewrites the header with the new
+// table, the file is still the old index
+void initAppendingIHashTable(char *fileName)
+{
+  IndexHeader header;
+  int tmp;
+
+  _ih_fp = fileOpen(fileName, "r+");
+  tmp = fread(&header, sizeof(header), 1, _ih_fp);
+
+  _ih_chunkCnt = _ih_appendChunkCnt = header.chunkCnt;
+  _ih_chunkCapacity = (header.chunkCnt > 64) ? header.chunkCnt : 64;
+  _ih_chunks = getMem(sizeof(IndexChunk) * _ih_chunkCapacity);
+
+  fseeko(_ih_fp, header.chunkTableOffset, SEEK_SET);
+  if (tmp == 0 || fread(_ih_chunks, sizeof(IndexChunk), _ih_chunkCnt, _ih_fp) != _ih_chunkCnt)
+    {
+      fprintf(stderr, "Read error while appending to hash table.\n");
+      exit(0);
+    }
+  fseeko(_ih_fp, 0, SEEK_END);
+  writeIHashTablePadding();
+}
+/**********************************************/
+// 1 if the contig was indexed before --index-append
+int isIHashTableChunkIndexed(char *refGenName)
+{
+  unsigned int i;
+
+  for (i=0; i<_ih_appendChunkCnt; i++)
+    if (strcmp(_ih_chunks[i].name, refGenName) == 0)
+      return 1;
+  return 0;
+}
+/**********************************************/
 void initSavingIHashTable(char *fileName)
 {
   int tmp;
+  IndexHeader header;
+
+  if (indexAppendMode)
+    {
+      initAppendingIHashTable(fileName);
+      return;
+    }
+
   _ih_fp = fileOpen(fileName, "w");
-  unsigned char bIndex = 0;				// Bisulfite Index
-	
-  // First Two bytes are indicating the type of the index & window size
-  tmp = fwrite(&bIndex, sizeof(bIndex), 1, _ih_fp);
-  tmp = fwrite(&WINDOW_SIZE, sizeof(WINDOW_SIZE), 1, _ih_fp);
-	
+
+  // The header is rewritten with the chunk table position in finalizeSavingIHashTable
+  memset(&header, 0, sizeof(header));
+  tmp = fwrite(&header, sizeof(header), 1, _ih_fp);
+
   if (tmp == 0)
     fprintf(stderr, "Write error while initializing hash table.\n");
 
+  _ih_chunkCnt = 0;
 }
 /**********************************************/
 void finalizeSavingIHashTable()
 {
+  int tmp;
+  IndexHeader header;
+
+  writeIHashTablePadding();
+
+  memset(&header, 0, sizeof(header));
+  header.type = INDEX_TYPE_FLAT;
+  header.windowSize = WINDOW_SIZE;
+  header.flags = (indexCompressed && !indexFM) ? INDEX_FLAG_COMPRESSED : 0;
+  header.flags |= (indexPackedRef) ? INDEX_FLAG_PACKED_REF : 0;
+  header.flags |= (indexFM) ? INDEX_FLAG_FM : 0;
+  header.flags |= (indexMinimizer) ? INDEX_FLAG_MINIMIZER : 0;
+  header.flags |= (seedCnt) ? INDEX_FLAG_SPACED : 0;
+  header.chunkCnt = _ih_chunkCnt;
+  header.chunkTableOffset = ftello(_ih_fp);
+  header.maxFreq = maxKeyFrequency;
+  header.minimizerWindow = indexMinimizer;
+  header.seedCnt = seedCnt;
+  memcpy(header.seedMask, seedMask, sizeof(seedMask));
+
+  // The header goes last, once the chunks and their table are written
+  tmp = (fwrite(_ih_chunks, sizeof(IndexChunk), _ih_chunkCnt, _ih_fp) == _ih_chunkCnt && fflush(_ih_fp) == 0);
+  if (tmp)
+    {
+      fseeko(_ih_fp, 0, SEEK_SET);
+      tmp = fwrite(&header, sizeof(header), 1, _ih_fp);
+    }
+
+  if (tmp == 0)
+    fprintf(stderr, "Write error while finalizing hash table.\n");
+
   fclose(_ih_fp);
+  if (_ih_chunks != NULL)
+    freeMem(_ih_chunks, sizeof(IndexChunk) * _ih_chunkCapacity);
+  _ih_chunks = NULL;
+  _ih_chunkCnt = _ih_chunkCapacity = _ih_appendChunkCnt = 0;
 }
 /**********************************************/
-void saveIHashTable(IHashTable *hashTable,  unsigned int size, unsigned int maxSize, char *refGen, char *refGenName, int refGenOffset)
+void saveIHashTableRef(IndexChunk *chunk, char *refGen)
 {
   int tmp;
-	
-  // Every Chunk starts with a byte indicating whether it has extra info;
-  unsigned char extraInfo = 0;
-  tmp = fwrite (&extraInfo, sizeof(extraInfo), 1, _ih_fp);
-
-  short len = strlen(refGenName);
-  tmp = fwrite(&len, sizeof(len), 1, _ih_fp);
-  tmp = fwrite(refGenName, sizeof(char), len, _ih_fp);
+  long long start = ftello(_ih_fp);
 
-  tmp = fwrite(&refGenOffset, sizeof(refGenOffset), 1, _ih_fp);
-	
-  unsigned int refGenLength = strlen(refGen);
-  tmp = fwrite(&refGenLength, sizeof(refGenLength), 1, _ih_fp);
-	
-  tmp = fwrite(refGen, sizeof(char), refGenLength, _ih_fp);
-  tmp = fwrite(&size, sizeof(size), 1, _ih_fp);
+  chunk->refGenLength = strlen(refGen);
 
-  int i=0,j=0;
-  unsigned char cnt=0;
-  for (i=0; i<maxSize; i++)
+  if (!indexPackedRef)
     {
-      if (hashTable[i].locs != NULL)
-	{
-	  tmp = fwrite(&i, sizeof(i), 1, _ih_fp);
+      tmp = fwrite(refGen, sizeof(char), chunk->refGenLength + 1, _ih_fp);
+    }
+  else
+    {
+      unsigned int i, j, n = (chunk->refGenLength + 3) / 4, runCnt = 0;
+      unsigned char *packed = getMem(n + 1);
+      unsigned char code;
+      IndexRefRun run;
 
-	  if (hashTable[i].locs[0] < 250)
+      for (i=0; i<n; i++)
+	{
+	  packed[i] = 0;
+	  for (j=0; j<4 && 4*i+j < chunk->refGenLength; j++)
 	    {
-	      cnt = hashTable[i].locs[0];
-	      tmp = fwrite(&cnt, sizeof(cnt), 1, _ih_fp);
+	      switch (refGen[4*i+j])
+		{
+		case 'C': code = 1; break;
+		case 'G': code = 2; break;
+		case 'T': code = 3; break;
+		default:  code = 0; break;
+		}
+	      packed[i] |= code << (2*j);
 	    }
-	  else
+	}
+      tmp = fwrite(packed, 1, n, _ih_fp);
+      freeMem(packed, n + 1);
+
+      // Runs of anything else than ACGT, counted first
+      for (j=0; j<2; j++)
+	{
+	  if (j == 1)
+	    tmp = fwrite(&runCnt, sizeof(runCnt), 1, _ih_fp);
+	  for (i=0; i<chunk->refGenLength; i++)
 	    {
-	      cnt =0;
-	      tmp = fwrite (&cnt, sizeof(cnt), 1, _ih_fp);
-	      tmp = fwrite (&(hashTable[i].locs[0]), sizeof(hashTable[i].locs[0]), 1, _ih_fp);
+	      if (refGen[i] == 'A' || refGen[i] == 'C' || refGen[i] == 'G' || refGen[i] == 'T')
+		continue;
+	      run.pos = i;
+	      run.ch = refGen[i];
+	      while (i+1 < chunk->refGenLength && refGen[i+1] == refGen[run.pos])
+		i++;
+	      run.len = i - run.pos + 1;
+	      if (j == 0)
+		runCnt++;
+	      else
+		tmp = fwrite(&run, sizeof(run), 1, _ih_fp);
 	    }
+	}
+    }
+  writeIHashTablePadding();
+  chunk->refBytes = ftello(_ih_fp) - start;
+
+  if (tmp == 0)
+    fprintf(stderr, "Write error while saving hash table.\n");
+}
+/**********************************************/
+IndexChunk *addIHashTableChunk()
+{
+  if (_ih_chunkCnt == _ih_chunkCapacity)
+    {
+      unsigned int newCapacity = (_ih_chunkCapacity == 0) ? 64 : 2 * _ih_chunkCapacity;
+      IndexChunk *tmp = getMem(sizeof(IndexChunk) * newCapacity);
+      if (_ih_chunks != NULL)
+	{
+	  memcpy(tmp, _ih_chunks, sizeof(IndexChunk) * _ih_chunkCnt);
+	  freeMem(_ih_chunks, sizeof(IndexChunk) * _ih_chunkCapacity);
+	}
+      _ih_chunks = tmp;
+      _ih_chunkCapacity = newCapacity;
+    }
+  memset(&_ih_chunks[_ih_chunkCnt], 0, sizeof(IndexChunk));
+  return &_ih_chunks[_ih_chunkCnt++];
+}
+/**********************************************/
+// Keys above maxKeyFrequency, kept out of the chunk until saveIHashTableOverflow
+typedef struct
+{
+  unsigned long long	key;
+  unsigned int		*locs;
+  unsigned int		cnt;
+} IHashTableOverflow;
+/**********************************************/
+IHashTableOverflow *addIHashTableOverflow(IHashTableOverflow *ov, unsigned int *ovCnt, unsigned int *ovCapacity)
+{
+  if (*ovCnt == *ovCapacity)
+    {
+      unsigned int newCapacity = (*ovCapacity == 0) ? 64 : 2 * *ovCapacity;
+      IHashTableOverflow *tmp = getMem(sizeof(IHashTableOverflow) * newCapacity);
+      if (ov != NULL)
+	{
+	  memcpy(tmp, ov, sizeof(IHashTableOverflow) * *ovCnt);
+	  freeMem(ov, sizeof(IHashTableOverflow) * *ovCapacity);
+	}
+      ov = tmp;
+      *ovCapacity = newCapacity;
+    }
+  (*ovCnt)++;
+  return ov;
+}
+/**********************************************/
+void saveIHashTableOverflow(IndexChunk *chunk, IHashTableOverflow *ov, unsigned int ovCnt, unsigned int ovCapacity)
+{
+  int tmp = 1;
+  unsigned int k, pos = 0;
+
+  chunk->overflowOffset = ftello(_ih_fp);
+  chunk->overflowKeyCnt = ovCnt;
+  chunk->overflowLocCnt = 0;
+
+  for (k=0; k<ovCnt; k++)
+    tmp = fwrite(&ov[k].key, sizeof(unsigned long long), 1, _ih_fp);
+  for (k=0; k<ovCnt; k++)
+    {
+      tmp = fwrite(&pos, sizeof(pos), 1, _ih_fp);
+      pos += ov[k].cnt + 1;
+    }
+  for (k=0; k<ovCnt; k++)
+    {
+      tmp = fwrite(&ov[k].cnt, sizeof(unsigned int), 1, _ih_fp);
+      tmp = fwrite(ov[k].locs, sizeof(unsigned int), ov[k].cnt, _ih_fp);
+      chunk->overflowLocCnt += ov[k].cnt;
+    }
+  writeIHashTablePadding();
+
+  if (ov != NULL)
+    freeMem(ov, sizeof(IHashTableOverflow) * ovCapacity);
 
-	  for (j=1; j<=hashTable[i].locs[0]; j++)
-	    tmp = fwrite(&(hashTable[i].locs[j]), sizeof(hashTable[i].locs[j]), 1, _ih_fp);
+  if (tmp == 0)
+    fprintf(stderr, "Write error while saving hash table.\n");
+}
+/**********************************************/
+void saveIHashTable(unsigned int *bucketStart, unsigned int *locs, unsigned int maxSize, char *refGen, char *refGenName, int refGenOffset)
+{
+  int tmp;
+  IndexChunk *chunk = addIHashTableChunk();
+  IHashTableOverflow *ov = NULL;
+  unsigned int ovCnt = 0, ovCapacity = 0;
+  unsigned int i, k=0, pos=0, locCnt, size=0;
+
+  snprintf(chunk->name, CONTIG_NAME_SIZE, "%s", refGenName);
+  chunk->refGenOffset = refGenOffset;
+  chunk->offset = ftello(_ih_fp);
+
+  for (i=0; i<maxSize; i++)
+    {
+      locCnt = bucketStart[i+1] - bucketStart[i];
+      if (maxKeyFrequency > 0 && locCnt > maxKeyFrequency)
+	{
+	  ov = addIHashTableOverflow(ov, &ovCnt, &ovCapacity);
+	  ov[ovCnt-1].key = i;
+	  ov[ovCnt-1].locs = locs + bucketStart[i];
+	  ov[ovCnt-1].cnt = locCnt;
+	}
+      else if (locCnt > 0)
+	{
+	  chunk->locCnt += locCnt;
+	  size++;
+	}
+    }
+  chunk->keyCnt = size;
+
+  saveIHashTableRef(chunk, refGen);
+
+  unsigned int *keys = getMem(sizeof(unsigned int) * (size+1));
+  unsigned int *starts = getMem(sizeof(unsigned int) * (size+1));
+
+  for (i=0; i<maxSize; i++)
+    {
+      locCnt = bucketStart[i+1] - bucketStart[i];
+      if (locCnt > 0 && (maxKeyFrequency == 0 || locCnt <= maxKeyFrequency))
+	{
+	  keys[k] = i;
+	  starts[k] = pos;
+	  pos += locCnt + 1;
+	  k++;
+	}
+    }
+
+  if (indexCompressed)
+    {
+      // Keys and the running location counts as two coded streams, then
+      // the coded locations of every key
+      unsigned int maxCnt = 0;
+      for (k=0, pos=0; k<size; k++)
+	{
+	  locCnt = bucketStart[keys[k]+1] - bucketStart[keys[k]];
+	  if (locCnt > maxCnt)
+	    maxCnt = locCnt;
+	  pos += locCnt;
+	  starts[k] = pos;
+	}
+
+      unsigned int bufSize = 5 * ((maxCnt > size) ? maxCnt : size) + 32;
+      unsigned char *buf = getMem(bufSize);
+      unsigned char *end;
+
+      end = encodeGroupVarint(keys, size, buf);
+      tmp = fwrite(buf, 1, end - buf, _ih_fp);
+      chunk->locBytes += end - buf;
+      end = encodeGroupVarint(starts, size, buf);
+      tmp = fwrite(buf, 1, end - buf, _ih_fp);
+      chunk->locBytes += end - buf;
+
+      for (k=0; k<size; k++)
+	{
+	  i = keys[k];
+	  end = encodeGroupVarint(locs + bucketStart[i], bucketStart[i+1] - bucketStart[i], buf);
+	  tmp = fwrite(buf, 1, end - buf, _ih_fp);
+	  chunk->locBytes += end - buf;
+	}
+
+      // Slack for the 16 byte loads of the decoder
+      memset(buf, 0, 16);
+      tmp = fwrite(buf, 1, 16, _ih_fp);
+      chunk->locBytes += 16;
+      freeMem(buf, bufSize);
+    }
+  else
+    {
+      tmp = fwrite(keys, sizeof(unsigned int), size, _ih_fp);
+      tmp = fwrite(starts, sizeof(unsigned int), size, _ih_fp);
+
+      for (k=0; k<size; k++)
+	{
+	  i = keys[k];
+	  locCnt = bucketStart[i+1] - bucketStart[i];
+	  tmp = fwrite(&locCnt, sizeof(locCnt), 1, _ih_fp);
+	  tmp = fwrite(locs + bucketStart[i], sizeof(unsigned int), locCnt, _ih_fp);
 	}
     }
+  writeIHashTablePadding();
+  saveIHashTableOverflow(chunk, ov, ovCnt, ovCapacity);
+
+  freeMem(keys, sizeof(unsigned int) * (size+1));
+  freeMem(starts, sizeof(unsigned int) * (size+1));
 
   if (tmp == 0)
     fprintf(stderr, "Write error while saving hash table.\n");
 }
 /**********************************************/
-unsigned int addIHashTableLocation(IHashTable *hashTable, int hv, int location)
+typedef struct
+{
+  char		*refGen;
+  int		beg;			// Range of positions (pass 1 & 2) or buckets (sorting)
+  int		end;
+  unsigned int	*bucketStart;
+  unsigned int	*locs;
+} IHashTableWorker;
+/**********************************************/
+void *countIHashTableRange(void *arg)
+{
+  IHashTableWorker *w = arg;
+  IHashRoller r;
+  int i, hv;
+
+  if (w->beg >= w->end)
+    return NULL;
+
+  initIHashRoller(&r);
+  for (i=w->beg; i < w->end + WINDOW_SIZE - 1; i++)
+    {
+      // Window starting at i - WINDOW_SIZE + 1
+      hv = rollIHashVal(&r, w->refGen[i]);
+      if (hv != -1)
+	{
+	  if (threadCount > 1)
+	    __sync_fetch_and_add(&w->bucketStart[hv+2], 1);
+	  else
+	    w->bucketStart[hv+2]++;
+	}
+    }
+  return NULL;
+}
+/**********************************************/
+void *scatterIHashTableRange(void *arg)
 {
-  unsigned int	sizeInc				= 0;
+  IHashTableWorker *w = arg;
+  IHashRoller r;
+  int i, hv;
+
+  if (w->beg >= w->end)
+    return NULL;
+
+  initIHashRoller(&r);
+  for (i=w->beg; i < w->end + WINDOW_SIZE - 1; i++)
+    {
+      hv = rollIHashVal(&r, w->refGen[i]);
+      if (hv != -1)
+	{
+	  if (threadCount > 1)
+	    w->locs[__sync_fetch_and_add(&w->bucketStart[hv+1], 1)] = i - WINDOW_SIZE + 2;
+	  else
+	    w->locs[w->bucketStart[hv+1]++] = i - WINDOW_SIZE + 2;
+	}
+    }
+  return NULL;
+}
+/**********************************************/
+int compareLocation(const void *a, const void *b)
+{
+  unsigned int x = *(unsigned int *)a;
+  unsigned int y = *(unsigned int *)b;
+  return (x > y) - (x < y);
+}
+/**********************************************/
+// Concurrent scattering leaves each bucket as a mix of sorted runs, one per thread
+void *sortIHashTableRange(void *arg)
+{
+  IHashTableWorker *w = arg;
+  unsigned int *l, tmp;
+  int hv, i, j, n;
+
+  for (hv=w->beg; hv < w->end; hv++)
+    {
+      l = w->locs + w->bucketStart[hv];
+      n = w->bucketStart[hv+1] - w->bucketStart[hv];
+      if (n > 16)
+	{
+	  qsort(l, n, sizeof(unsigned int), compareLocation);
+	  continue;
+	}
+      for (i=1; i < n; i++)
+	{
+	  tmp = l[i];
+	  for (j=i; j > 0 && l[j-1] > tmp; j--)
+	    l[j] = l[j-1];
+	  l[j] = tmp;
+	}
+    }
+  return NULL;
+}
+/**********************************************/
+// Splits [0, n) into threadCount ranges and runs func on each of them
+void runIHashTableWorkers(void *(*func)(void *), int n, char *refGen, unsigned int *bucketStart, unsigned int *locs)
+{
+  IHashTableWorker	w[threadCount];
+  pthread_t		t[threadCount];
+  int i;
+
+  for (i=0; i < threadCount; i++)
+    {
+      w[i].refGen = refGen;
+      w[i].beg = (long long) n * i / threadCount;
+      w[i].end = (long long) n * (i+1) / threadCount;
+      w[i].bucketStart = bucketStart;
+      w[i].locs = locs;
+    }
+
+  if (threadCount == 1)
+    {
+      func(&w[0]);
+      return;
+    }
+
+  for (i=0; i < threadCount; i++)
+    {
+      if (pthread_create(&t[i], NULL, func, &w[i]) != 0)
+	{
+	  fprintf(stderr, "Error: Cannot create indexing thread.\n");
+	  exit(0);
+	}
+    }
+  for (i=0; i < threadCount; i++)
+    pthread_join(t[i], NULL);
+}
+/**********************************************/
+// Two pass bucketing of one chunk: the first pass counts the bucket sizes,
+// the second one scatters the locations into a single contiguous array.
+// On return locs[bucketStart[hv]..bucketStart[hv+1]-1] holds the sorted
+// locations of hv. bucketStart has maxSize+2 entries.
+unsigned int bucketIHashTable(char *refGen, unsigned int *bucketStart, unsigned int maxSize, unsigned int **locs, unsigned int *locsCapacity)
+{
+  unsigned int	hashTableSize		= 0;
+  unsigned int	totalLocs;
+  int i, l;
+
+  l = strlen(refGen) - WINDOW_SIZE;
+  if (l < 0)
+    l = 0;
+
+  memset(bucketStart, 0, sizeof(unsigned int)*(maxSize+2));
+
+  runIHashTableWorkers(countIHashTableRange, l, refGen, bucketStart, NULL);
+
+  // bucketStart[hv+1] becomes the first slot of hv
+  for (i=0; i < maxSize; i++)
+    {
+      if (bucketStart[i+2] > 0)
+	hashTableSize++;
+      bucketStart[i+2] += bucketStart[i+1];
+    }
+
+  totalLocs = bucketStart[maxSize+1];
+  if (totalLocs > *locsCapacity)
+    {
+      if (*locs != NULL)
+	freeMem(*locs, sizeof(unsigned int) * (*locsCapacity));
+      *locs = getMem(sizeof(unsigned int) * totalLocs);
+      *locsCapacity = totalLocs;
+    }
+
+  // After scattering bucketStart[hv+1] is the end of hv, i.e. bucketStart[hv] is its start
+  runIHashTableWorkers(scatterIHashTableRange, l, refGen, bucketStart, *locs);
+
+  if (threadCount > 1)
+    runIHashTableWorkers(sortIHashTableRange, maxSize, refGen, bucketStart, *locs);
+
+  return hashTableSize;
+}
+/**********************************************/
+// Buffers of an index build, reused from chunk to chunk and, with a list
+// of window sizes, from one window size to the next
+typedef struct
+{
+  unsigned int		*bucketStart;			// 4^WINDOW_SIZE+2 bucket bounds
+  unsigned int		bucketCapacity;
+  unsigned int		*locs;
+  unsigned int		locsCapacity;
+  unsigned long long	*keys;				// Key/location pairs of the 64-bit key layout
+  unsigned long long	*tmpKeys;
+  unsigned int		*pairLocs;
+  unsigned int		*tmpLocs;
+  unsigned int		pairCapacity;
+} IHashTableBuild;
+
+void freeIHashTableBuild(IHashTableBuild *b)
+{
+  if (b->bucketStart != NULL)
+    freeMem(b->bucketStart, sizeof(unsigned int) * b->bucketCapacity);
+  if (b->locs != NULL)
+    freeMem(b->locs, sizeof(unsigned int) * b->locsCapacity);
+  if (b->keys != NULL)
+    {
+      freeMem(b->keys, sizeof(unsigned long long) * b->pairCapacity);
+      freeMem(b->tmpKeys, sizeof(unsigned long long) * b->pairCapacity);
+      freeMem(b->pairLocs, sizeof(unsigned int) * b->pairCapacity);
+      freeMem(b->tmpLocs, sizeof(unsigned int) * b->pairCapacity);
+    }
+  memset(b, 0, sizeof(IHashTableBuild));
+}
+/**********************************************/
+void indexIHashTableChunk(IHashTableBuild *b, char *refGen, char *refGenName, int refGenOff)
+{
+  unsigned int hashTableMaxSize = pow(4, WINDOW_SIZE);
+
+  if (hashTableMaxSize + 2 > b->bucketCapacity)
+    {
+      if (b->bucketStart != NULL)
+	freeMem(b->bucketStart, sizeof(unsigned int) * b->bucketCapacity);
+      b->bucketCapacity = hashTableMaxSize + 2;
+      b->bucketStart = getMem(sizeof(unsigned int) * b->bucketCapacity);
+    }
+
+  bucketIHashTable(refGen, b->bucketStart, hashTableMaxSize, &b->locs, &b->locsCapacity);
+  saveIHashTable(b->bucketStart, b->locs, hashTableMaxSize, refGen, refGenName, refGenOff);
+}
+/**********************************************/
+// Prints the contig being indexed, or a dot for its next chunk
+void printIHashTableProgress(char *prev, char *refGenName)
+{
+  if ( strcmp(prev, refGenName) != 0)
+    {
+      fprintf(stderr, "\n - %s ", refGenName);
+      fflush(stderr);
+      sprintf(prev, "%s", refGenName);
+    }
+  else
+    {
+      fprintf(stderr, ".");
+      fflush(stderr);
+    }
+}
+/**********************************************/
+void generateIHashTable(char *fileName, char *indexName)
+{
+  double          startTime           = getTime();
+  IHashTableBuild	build;
+  char 			*refGenName;
+  char			*refGen;
+  int				refGenOff			= 0;
+  int flag;
+
+
+  //Loading Fasta File
+  if (!initLoadingRefGenome(fileName))
+    return;		
+  initSavingIHashTable(indexName);
+  memset(&build, 0, sizeof(build));
+	
+  fprintf(stderr, "Generating Index from %s", fileName);
+  fflush(stderr);
+
+  char *prev = getMem (CONTIG_NAME_SIZE);
+  prev[0]='\0';
+
+  do
+    {
+      flag = 	 loadRefGenome (&refGen, &refGenName, &refGenOff);	
+
+      if (indexAppendMode && isIHashTableChunkIndexed(refGenName))
+	continue;
+
+      printIHashTableProgress(prev, refGenName);
+      indexIHashTableChunk(&build, refGen, refGenName, refGenOff);
+    } while (flag);
+
+  freeMem(prev, CONTIG_NAME_SIZE);
+  freeIHashTableBuild(&build);
+
+  finalizeLoadingRefGenome();
+  finalizeSavingIHashTable();
+
+  fprintf(stderr, "\nDONE in %0.2fs!\n", (getTime()-startTime));
+}
+
+/**********************************************/
+// 1 if name is one of the comma separated names of list
+int inContigList(char *list, char *name)
+{
+  int len = strlen(name);
+  char *p = list, *end;
+
+  while (*p)
+    {
+      end = strchr(p, ',');
+      if (end == NULL)
+	end = p + strlen(p);
+      if (end - p == len && strncmp(p, name, len) == 0)
+	return 1;
+      p = (*end) ? end + 1 : end;
+    }
+  return 0;
+}
+/**********************************************/
+// Applies --contigs, --exclude-contigs and --contig-regex to a chunk name
+int useIHashTableChunk(char *name)
+{
+  if (contigInclude != NULL && !inContigList(contigInclude, name))
+    return 0;
+  if (contigExclude != NULL && inContigList(contigExclude, name))
+    return 0;
+  if (contigRegex != NULL && regexec(&_ih_contigRegex, name, 0, NULL, 0) != 0)
+    return 0;
+  return 1;
+}
+/**********************************************/
+// Index of the next chunk that passes the contig filters, -1 at the end.
+// Filtered chunks are skipped through the chunk table without touching them.
+int nextIHashTableChunk()
+{
+  int i;
+
+  for (i=_ih_curChunk+1; i < (int)_ih_chunkCnt; i++)
+    if (useIHashTableChunk(_ih_chunks[i].name))
+      return i;
+  return -1;
+}
+/**********************************************/
+void finalizeLoadingIHashTable()
+{
+  freeIHashTableContent(_ih_hashTable, _ih_maxHashTableSize);
+  freeLargeMem(_ih_hashTable, sizeof(IHashTable)* _ih_maxHashTableSize);
+  freeLargeMem(_ih_refGen, strlen(_ih_refGen)+1) ;
+  freeMem(_ih_refGenName, strlen(_ih_refGenName)+1);
+  fclose(_ih_fp);
+}
+
+/**********************************************/
+// Reads the next chunk of a chunk stream index; 0 at its end
+int readIHashTableChunk()
+{
+  unsigned char extraInfo = 0;
+  short len;
+  unsigned int refGenLength;
+  unsigned int hashTableSize;
+  unsigned int tmpSize;
+  int tmp;
+  int i=0,j=0;
+
+  if ( fread(&extraInfo, sizeof(extraInfo), 1, _ih_fp) != sizeof(extraInfo) )
+    return 0;
+
+  freeIHashTableContent(_ih_hashTable, _ih_maxHashTableSize);
+  freeLargeMem(_ih_refGen, strlen(_ih_refGen)+1) ;
+  freeMem(_ih_refGenName, strlen(_ih_refGenName)+1);
+
+  // Reading Chr Name
+  tmp = fread(&len, sizeof(len), 1, _ih_fp);
+  if (tmp == 0){
+    fprintf(stderr, "Read error while loading hash table.\n");
+    exit(0);
+  }
+
+  _ih_refGenName = getMem(sizeof(char)* (len+1));
+  tmp = fread(_ih_refGenName, sizeof(char), len, _ih_fp);
+  _ih_refGenName [len] ='\0';
+
+  tmp = fread(&_ih_refGenOff, sizeof (_ih_refGenOff), 1, _ih_fp);
+
+  // Reading Size and Content of Ref Genome
+  tmp = fread(&refGenLength, sizeof(refGenLength), 1, _ih_fp);
+  _ih_refGen = getLargeMem(sizeof(char)*(refGenLength+1));
+  tmp = fread(_ih_refGen, sizeof(char), refGenLength, _ih_fp);
+  _ih_refGen[refGenLength]='\0';
+
+  //Reading Hashtable Size and Content
+  tmp = fread(&hashTableSize, sizeof(hashTableSize), 1, _ih_fp);
+	
+  unsigned int hv;
+  unsigned char cnt=0;
+  //unsigned int  index = 1;
+  //unsigned int  tmpValue = 0;
+
+  for (i=0; i<hashTableSize; i++)
+    {
+      //index = 1;
+      tmp = fread(&hv, sizeof(hv), 1, _ih_fp);
+      tmp = fread(&cnt, sizeof(cnt), 1, _ih_fp);
+
+      if (cnt>0)
+	{
+	  tmpSize = cnt;
+	}
+      else
+	{
+	  tmp = fread(&tmpSize, sizeof(tmpSize), 1, _ih_fp);
+	}
+		
+      _ih_hashTable[hv].locs = getMem( sizeof(unsigned int)* (tmpSize+1) );
+      _ih_hashTable[hv].locs[0] = tmpSize;
+
+		
+      for (j=1; j<=tmpSize; j++) 
+	tmp = fread(&(_ih_hashTable[hv].locs[j]), sizeof(_ih_hashTable[hv].locs[j]), 1, _ih_fp);
+		
+      /*
+
+	if(tmpSize != 0)
+	{
+	tmp = fread(&(_ih_hashTable[hv].locs[index]), sizeof(_ih_hashTable[hv].locs[index]), 1, _ih_fp);
+	index++;
+	}
+
+	for (j=2; j<=tmpSize; j++)	
+	{
+	tmp = fread(&tmpValue, sizeof(_ih_hashTable[hv].locs[index-1]), 1, _ih_fp);
+	if(abs(tmpValue-_ih_hashTable[hv].locs[index-1]) >  errThreshould)
+	{
+	_ih_hashTable[hv].locs[index] = tmpValue;
+	index++;
+	}
+	}
+	_ih_hashTable[hv].locs[0] = index-1;
+		
+      */
+    }
+
+  return 1;
+}
+/**********************************************/
+int  loadIHashTable(double *loadTime)
+{
+  double startTime = getTime();
+
+  // Chunk streams have no seek table; filtered chunks are read and dropped
+  do
+    {
+      if (!readIHashTableChunk())
+	return 0;
+    }
+  while (!useIHashTableChunk(_ih_refGenName));
+
+  *loadTime = getTime()-startTime;
+  return 1;
+}
+/**********************************************/
+void clearFlatIHashTable()
+{
+  unsigned int k;
+
+  if (_ih_curKeys == NULL)
+    return;
+  for (k=0; k<_ih_chunks[_ih_curChunk].keyCnt; k++)
+    _ih_hashTable[_ih_curKeys[k]].locs = NULL;
+  _ih_curKeys = NULL;
+}
+/**********************************************/
+// End of the reference and the key and location tables of a chunk
+unsigned long long getIHashTableChunkEnd(IndexChunk *chunk)
+{
+  if (chunk->overflowOffset > chunk->offset)
+    return chunk->overflowOffset;
+  return chunk->offset + chunk->refBytes + chunk->locBytes;
+}
+/**********************************************/
+// Buffers of the slot for chunk; allocated here so that the prefetch thread
+// never allocates
+void reserveIHashTableSlot(IHashTableSlot *slot, int chunk)
+{
+  IndexChunk *c = &_ih_chunks[chunk];
+  unsigned int need = c->locCnt + 3*c->keyCnt + 12;
+  int compressed = (_ih_flags & INDEX_FLAG_COMPRESSED) && !indexFM;
+
+  slot->chunk = chunk;
+  // The verification reads up to a read length past the end of the chunk
+  if ((_ih_flags & INDEX_FLAG_PACKED_REF) && c->refGenLength + IH_REF_PADDING > slot->refBufSize)
+    {
+      if (slot->refBuf != NULL)
+	freeLargeMem(slot->refBuf, slot->refBufSize);
+      slot->refBufSize = c->refGenLength + IH_REF_PADDING;
+      slot->refBuf = getLargeMem(slot->refBufSize);
+    }
+
+  if (compressed && need > slot->locBufSize)
+    {
+      if (slot->locBuf != NULL)
+	freeLargeMem(slot->locBuf, sizeof(unsigned int) * slot->locBufSize);
+      slot->locBuf = getLargeMem(sizeof(unsigned int) * need);
+      slot->locBufSize = need;
+    }
+
+  // Placed memory cannot back the page cache; the reference and the keys and
+  // starts, which every lookup touches, are copied instead. The location
+  // lists stay mapped.
+  slot->copyBytes = 0;
+  if (indexHugePages || numaNodeMask)
+    {
+      if (indexFM)
+	slot->copyBytes = getIHashTableChunkEnd(c) - c->offset;
+      else if (!compressed)
+	slot->copyBytes = c->refBytes + (IH_KEYS64 ? 12ULL : 8ULL) * c->keyCnt;
+      else
+	slot->copyBytes = c->refBytes + (IH_KEYS64 ? sizeof(unsigned long long) * c->keyCnt : 0);
+    }
+
+  if (slot->copyBytes > slot->copyBufSize)
+    {
+      if (slot->copyBuf != NULL)
+	freeLargeMem(slot->copyBuf, slot->copyBufSize);
+      slot->copyBuf = getLargeMem(slot->copyBytes);
+      slot->copyBufSize = slot->copyBytes;
+    }
+}
+/**********************************************/
+// Sets slot->ref to the reference of the chunk, unpacking it if needed. The
+// unpacked copy is private to the process; --packref saves index size and
+// load I/O, not reference memory.
+void loadIHashTableRef(IHashTableSlot *slot, IndexChunk *chunk)
+{
+  unsigned char *in = slot->base;
+  unsigned int i, n, runCnt;
+  IndexRefRun *runs;
+
+  if (!(_ih_flags & INDEX_FLAG_PACKED_REF))
+    {
+      slot->ref = (char *)in;
+      return;
+    }
+
+  n = (chunk->refGenLength + 3) / 4;
+  for (i=0; i<n; i++)
+    memcpy(slot->refBuf + 4*i, &_ih_unpack[in[i]], 4);
+
+  memcpy(&runCnt, in + n, sizeof(runCnt));
+  runs = (IndexRefRun *)(in + n + sizeof(runCnt));
+  for (i=0; i<runCnt; i++)
+    memset(slot->refBuf + runs[i].pos, runs[i].ch, runs[i].len);
+
+  memset(slot->refBuf + chunk->refGenLength, 0, slot->refBufSize - chunk->refGenLength);
+  slot->ref = slot->refBuf;
+}
+/**********************************************/
+// Decodes the running counts and the location lists of a compressed chunk
+// into slot->locBuf as [count, loc1..locN] per key. The returned array, stored
+// behind the location area, holds the start of every key in slot->locBuf.
+unsigned int *decodeIHashTableLocs(IHashTableSlot *slot, unsigned char *in, IndexChunk *chunk)
+{
+  unsigned int *starts = slot->locBuf + chunk->locCnt + chunk->keyCnt + 4;
+  unsigned int *locs = slot->locBuf;
+  unsigned int k, prev = 0, cnt;
+
+  in = decodeGroupVarint(in, starts, chunk->keyCnt);
+
+  for (k=0; k<chunk->keyCnt; k++)
+    {
+      cnt = starts[k] - prev;
+      prev = starts[k];
+      starts[k] = locs - slot->locBuf;
+      locs[0] = cnt;
+      in = decodeGroupVarint(in, locs+1, cnt);
+      locs += cnt + 1;
+    }
+  return starts;
+}
+/**********************************************/
+// Unpacks and decodes the chunk of a reserved slot. Chunks that are used in
+// place are read through once so that mapping does not wait for the disk.
+void *fillIHashTableSlot(void *arg)
+{
+  IHashTableSlot *slot = arg;
+  IndexChunk *chunk = &_ih_chunks[slot->chunk];
+  unsigned char *in = _ih_map + chunk->offset + chunk->refBytes;
+  unsigned long long end, pos;
+  volatile unsigned char sum = 0;
+
+  slot->base = _ih_map + chunk->offset;
+  slot->locs = (unsigned int *)(slot->base + chunk->refBytes + (IH_KEYS64 ? 12ULL : 8ULL) * chunk->keyCnt);
+  if (slot->copyBytes)
+    {
+      memcpy(slot->copyBuf, slot->base, slot->copyBytes);
+      slot->base = slot->copyBuf;
+    }
+  loadIHashTableRef(slot, chunk);
+
+  if ((_ih_flags & INDEX_FLAG_COMPRESSED) && !indexFM)
+    {
+      if (!IH_KEYS64)
+	{
+	  slot->keys = slot->locBuf + chunk->locCnt + 2*chunk->keyCnt + 8;
+	  in = decodeGroupVarint(in, slot->keys, chunk->keyCnt);
+	}
+      else
+	in += sizeof(unsigned long long) * chunk->keyCnt;
+      slot->starts = decodeIHashTableLocs(slot, in, chunk);
+      return NULL;
+    }
+
+  end = getIHashTableChunkEnd(chunk);
+  pos = chunk->offset + slot->copyBytes;
+  if (pos >= end)
+    return NULL;
+  madvise(_ih_map + (pos & ~4095ULL), end - (pos & ~4095ULL), MADV_WILLNEED);
+  for (; pos < end; pos += 4096)
+    sum += _ih_map[pos];
+  return NULL;
+}
+/**********************************************/
+void waitIHashTablePrefetch()
+{
+  if (_ih_prefetching)
+    pthread_join(_ih_prefetchThread, NULL);
+  _ih_prefetching = 0;
+}
+/**********************************************/
+// Makes the slot of chunk current; it is prepared here unless the prefetch
+// thread already did
+IHashTableSlot *useIHashTableSlot(int chunk)
+{
+  if (_ih_residentSlots != NULL)
+    {
+      _ih_curRef = _ih_residentSlots[chunk].ref;
+      return &_ih_residentSlots[chunk];
+    }
+
+  waitIHashTablePrefetch();
+
+  if (_ih_slots[1 - _ih_slot].chunk == chunk)
+    _ih_slot = 1 - _ih_slot;
+  else
+    {
+      reserveIHashTableSlot(&_ih_slots[_ih_slot], chunk);
+      fillIHashTableSlot(&_ih_slots[_ih_slot]);
+    }
+  _ih_curRef = _ih_slots[_ih_slot].ref;
+  return &_ih_slots[_ih_slot];
+}
+/**********************************************/
+// Prepares the chunk after the current one in the other slot while the
+// current one is mapped
+void startIHashTablePrefetch()
+{
+  IHashTableSlot *slot = &_ih_slots[1 - _ih_slot];
+  int next = nextIHashTableChunk();
+
+  slot->chunk = -1;
+  if (!indexPrefetch || next < 0 || _ih_residentSlots != NULL)
+    return;
+
+  reserveIHashTableSlot(slot, next);
+  if (pthread_create(&_ih_prefetchThread, NULL, fillIHashTableSlot, slot) == 0)
+    _ih_prefetching = 1;
+  else
+    slot->chunk = -1;
+}
+/**********************************************/
+void finalizeIHashTableSlots()
+{
+  int i;
+
+  waitIHashTablePrefetch();
+  for (i=0; i<2; i++)
+    {
+      if (_ih_slots[i].refBuf != NULL)
+	freeLargeMem(_ih_slots[i].refBuf, _ih_slots[i].refBufSize);
+      if (_ih_slots[i].locBuf != NULL)
+	freeLargeMem(_ih_slots[i].locBuf, sizeof(unsigned int) * _ih_slots[i].locBufSize);
+      if (_ih_slots[i].copyBuf != NULL)
+	freeLargeMem(_ih_slots[i].copyBuf, _ih_slots[i].copyBufSize);
+    }
+  memset(_ih_slots, 0, sizeof(_ih_slots));
+  _ih_slots[0].chunk = _ih_slots[1].chunk = -1;
+}
+/**********************************************/
+void finalizeLoadingFlatIHashTable()
+{
+  clearFlatIHashTable();
+  finalizeIHashTableSlots();
+  freeLargeMem(_ih_hashTable, sizeof(IHashTable)* _ih_maxHashTableSize);
+  freeLargeMem(_ih_refGen, strlen(_ih_refGen)+1) ;
+  freeMem(_ih_refGenName, strlen(_ih_refGenName)+1);
+  if (_ih_map != _ih_residentMap)
+    munmap(_ih_map, _ih_mapSize);
+  _ih_map = NULL;
+  _ih_chunks = NULL;
+  fclose(_ih_fp);
+}
+/**********************************************/
+void loadIHashTableOverflow(IndexChunk *chunk)
+{
+  _ih_ovKeyCnt = chunk->overflowKeyCnt;
+  if (_ih_ovKeyCnt == 0)
+    return;
+  _ih_ovKeys = (unsigned long long *)(_ih_map + chunk->overflowOffset);
+  _ih_ovStarts = (unsigned int *)(_ih_ovKeys + _ih_ovKeyCnt);
+  _ih_ovLocs = _ih_ovStarts + _ih_ovKeyCnt;
+}
+/**********************************************/
+// Candidates of a key that was above the frequency cap of the index
+unsigned int *getOverflowCandidates(long long hv)
+{
+  unsigned int lo = 0, hi = _ih_ovKeyCnt, mid;
+
+  if (hv == -1)
+    return NULL;
+
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (_ih_ovKeys[mid] < hv)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  if (lo < _ih_ovKeyCnt && _ih_ovKeys[lo] == hv)
+    return _ih_ovLocs + _ih_ovStarts[lo];
+  return NULL;
+}
+/**********************************************/
+// Points the buckets straight into the mapped chunk; nothing is copied
+int loadFlatIHashTable(double *loadTime)
+{
+  double startTime = getTime();
+  IndexChunk *chunk;
+  IHashTableSlot *slot;
+  unsigned int *starts, *locs;
+  unsigned int k;
+  int next = nextIHashTableChunk();
+
+  if (next < 0)
+    return 0;
+
+  clearFlatIHashTable();
+  slot = useIHashTableSlot(next);
+  _ih_curChunk = next;
+  chunk = &_ih_chunks[_ih_curChunk];
+
+  _ih_refGenOff = chunk->refGenOffset;
+  loadIHashTableOverflow(chunk);
+
+  if (_ih_flags & INDEX_FLAG_COMPRESSED)
+    {
+      _ih_curKeys = slot->keys;
+      for (k=0; k<chunk->keyCnt; k++)
+	_ih_hashTable[_ih_curKeys[k]].locs = slot->locBuf + slot->starts[k];
+    }
+  else
+    {
+      _ih_curKeys = (unsigned int *)(slot->base + chunk->refBytes);
+      starts = _ih_curKeys + chunk->keyCnt;
+      locs = slot->locs;
+
+      for (k=0; k<chunk->keyCnt; k++)
+	_ih_hashTable[_ih_curKeys[k]].locs = locs + starts[k];
+    }
+
+  startIHashTablePrefetch();
+  *loadTime = getTime()-startTime;
+  return 1;
+}
+/**********************************************/
+int initLoadingFlatIHashTable()
+{
+  struct stat st;
+  IndexHeader *header;
+
+  if (_ih_residentMap != NULL)
+    {
+      _ih_map = _ih_residentMap;
+      _ih_mapSize = _ih_residentMapSize;
+    }
+  else
+    {
+      if (fstat(fileno(_ih_fp), &st) != 0 || st.st_size < sizeof(IndexHeader))
+	{
+	  fprintf(stderr, "Error: Cannot read the index.\n");
+	  return 0;
+	}
+
+      _ih_mapSize = st.st_size;
+      _ih_map = mmap(NULL, _ih_mapSize, PROT_READ, MAP_SHARED, fileno(_ih_fp), 0);
+      if (_ih_map == MAP_FAILED)
+	{
+	  _ih_map = NULL;
+	  fprintf(stderr, "Error: Cannot map the index into memory.\n");
+	  return 0;
+	}
+    }
+
+  header = (IndexHeader *)_ih_map;
+  if (header->chunkTableOffset + sizeof(IndexChunk) * header->chunkCnt > _ih_mapSize)
+    {
+      fprintf(stderr, "Error: The index is truncated.\n");
+      return 0;
+    }
+
+  _ih_chunks = (IndexChunk *)(_ih_map + header->chunkTableOffset);
+  _ih_chunkCnt = header->chunkCnt;
+  _ih_flags = header->flags;
+  if (maxKeyFrequency == 0)
+    maxKeyFrequency = header->maxFreq;
+  initGroupVarint();
+
+  int i, j;
+  for (i=0; i<256; i++)
+    for (j=0; j<4; j++)
+      ((char *)&_ih_unpack[i])[j] = "ACGT"[(i >> (2*j)) & 3];
+  _ih_curChunk = -1;
+  _ih_curKeys = NULL;
+  _ih_slots[0].chunk = _ih_slots[1].chunk = -1;
+
+  if (!IH_KEYS64 && !indexFM)
+    {
+      loadHashTable = &loadFlatIHashTable;
+      finalizeLoadingHashTable = &finalizeLoadingFlatIHashTable;
+    }
+  return 1;
+}
+/**********************************************/
+unsigned int *getIHashTableCandidates(long long hv)
+{
+  if ( hv != -1 )
+    return _ih_hashTable[hv].locs;
+  else 
+    return NULL;
+}
+/**********************************************/
+/* Sorted 64-bit key table for WINDOW_SIZE > 15 */
+/* and minimizer or spaced seed indexes        */
+/**********************************************/
+// Stable LSD radix sort of the (key, location) pairs on 16 bit digits
+void sortKHashTablePairs(unsigned long long *keys, unsigned int *locs, unsigned long long *tmpKeys, unsigned int *tmpLocs, unsigned int n)
+{
+  unsigned int *cnt = getMem(sizeof(unsigned int) * ((1<<16)+1));
+  unsigned long long *k1 = keys, *k2 = tmpKeys, *kt;
+  unsigned int *l1 = locs, *l2 = tmpLocs, *lt;
+  unsigned int i, d, sum, c;
+  int shift;
+
+  for (shift=0; shift < getIHashKeyBits(); shift+=16)
+    {
+      memset(cnt, 0, sizeof(unsigned int) * ((1<<16)+1));
+      for (i=0; i<n; i++)
+	cnt[(k1[i] >> shift) & 0xFFFF]++;
+      for (d=0, sum=0; d < (1<<16); d++)
+	{
+	  c = cnt[d];
+	  cnt[d] = sum;
+	  sum += c;
+	}
+      for (i=0; i<n; i++)
+	{
+	  d = (k1[i] >> shift) & 0xFFFF;
+	  k2[cnt[d]] = k1[i];
+	  l2[cnt[d]++] = l1[i];
+	}
+      kt = k1; k1 = k2; k2 = kt;
+      lt = l1; l1 = l2; l2 = lt;
+    }
+
+  if (k1 != keys)
+    {
+      memcpy(keys, k1, sizeof(unsigned long long) * n);
+      memcpy(locs, l1, sizeof(unsigned int) * n);
+    }
+  freeMem(cnt, sizeof(unsigned int) * ((1<<16)+1));
+}
+/**********************************************/
+// Pairs must be sorted by key and location
+void saveKHashTable(unsigned long long *keys, unsigned int *locs, unsigned int n, char *refGen, char *refGenName, int refGenOffset)
+{
+  int tmp;
+  unsigned int i, j, k, size = 0, cnt;
+  IndexChunk *chunk = addIHashTableChunk();
+  IHashTableOverflow *ov = NULL;
+  unsigned int ovCnt = 0, ovCapacity = 0;
+
+  for (i=0; i<n; i=j)
+    {
+      for (j=i+1; j<n && keys[j] == keys[i]; j++);
+      if (maxKeyFrequency > 0 && j - i > maxKeyFrequency)
+	{
+	  ov = addIHashTableOverflow(ov, &ovCnt, &ovCapacity);
+	  ov[ovCnt-1].key = keys[i];
+	  ov[ovCnt-1].locs = locs + i;
+	  ov[ovCnt-1].cnt = j - i;
+	}
+      else
+	{
+	  chunk->locCnt += j - i;
+	  size++;
+	}
+    }
+
+  snprintf(chunk->name, CONTIG_NAME_SIZE, "%s", refGenName);
+  chunk->refGenOffset = refGenOffset;
+  chunk->keyCnt = size;
+  chunk->offset = ftello(_ih_fp);
+
+  saveIHashTableRef(chunk, refGen);
+
+  // first[k] is the first pair of the k-th kept key, ends[k] the running location count
+  unsigned long long *uniqueKeys = getMem(sizeof(unsigned long long) * (size+1));
+  unsigned int *first = getMem(sizeof(unsigned int) * (size+1));
+  unsigned int *ends = getMem(sizeof(unsigned int) * (size+1));
+
+  for (i=0, k=0, cnt=0; i<n; i=j)
+    {
+      for (j=i+1; j<n && keys[j] == keys[i]; j++);
+      if (maxKeyFrequency > 0 && j - i > maxKeyFrequency)
+	continue;
+      uniqueKeys[k] = keys[i];
+      first[k] = i;
+      cnt += j - i;
+      ends[k++] = cnt;
+    }
+
+  tmp = fwrite(uniqueKeys, sizeof(unsigned long long), size, _ih_fp);
+
+  if (indexCompressed)
+    {
+      unsigned int maxCnt = 0;
+      for (k=0, i=0; k<size; i=ends[k++])
+	if (ends[k] - i > maxCnt)
+	  maxCnt = ends[k] - i;
+
+      unsigned int bufSize = 5 * ((maxCnt > size) ? maxCnt : size) + 32;
+      unsigned char *buf = getMem(bufSize);
+      unsigned char *end;
+
+      end = encodeGroupVarint(ends, size, buf);
+      tmp = fwrite(buf, 1, end - buf, _ih_fp);
+      chunk->locBytes += end - buf;
+
+      for (k=0, i=0; k<size; i=ends[k++])
+	{
+	  end = encodeGroupVarint(locs + first[k], ends[k] - i, buf);
+	  tmp = fwrite(buf, 1, end - buf, _ih_fp);
+	  chunk->locBytes += end - buf;
+	}
+
+      memset(buf, 0, 16);
+      tmp = fwrite(buf, 1, 16, _ih_fp);
+      chunk->locBytes += 16;
+      freeMem(buf, bufSize);
+    }
+  else
+    {
+      for (k=0, i=0; k<size; i=ends[k++])
+	{
+	  j = i + k;		// Every key owns one slot for its count
+	  tmp = fwrite(&j, sizeof(j), 1, _ih_fp);
+	}
+      for (k=0, i=0; k<size; i=ends[k++])
+	{
+	  cnt = ends[k] - i;
+	  tmp = fwrite(&cnt, sizeof(cnt), 1, _ih_fp);
+	  tmp = fwrite(locs + first[k], sizeof(unsigned int), cnt, _ih_fp);
+	}
+    }
+  writeIHashTablePadding();
+  saveIHashTableOverflow(chunk, ov, ovCnt, ovCapacity);
+
+  freeMem(uniqueKeys, sizeof(unsigned long long) * (size+1));
+  freeMem(first, sizeof(unsigned int) * (size+1));
+  freeMem(ends, sizeof(unsigned int) * (size+1));
+
+  if (tmp == 0)
+    fprintf(stderr, "Write error while saving hash table.\n");
+}
+/**********************************************/
+void indexKHashTableChunk(IHashTableBuild *b, char *refGen, char *refGenName, int refGenOff)
+{
+  unsigned int		n;
+  int			i, l, s;
+  int			seedLoops		= (seedCnt) ? seedCnt : 1;
+  long long		hv;
+  IHashRoller		roller;
+  IHashMinimizer	mz;
+
+  l = strlen(refGen) - WINDOW_SIZE;
+  if (l < 0)
+    l = 0;
+
+  if (l * seedLoops > b->pairCapacity)
+    {
+      if (b->keys != NULL)
+	{
+	  freeMem(b->keys, sizeof(unsigned long long) * b->pairCapacity);
+	  freeMem(b->tmpKeys, sizeof(unsigned long long) * b->pairCapacity);
+	  freeMem(b->pairLocs, sizeof(unsigned int) * b->pairCapacity);
+	  freeMem(b->tmpLocs, sizeof(unsigned int) * b->pairCapacity);
+	}
+      b->pairCapacity = l * seedLoops;
+      b->keys = getMem(sizeof(unsigned long long) * b->pairCapacity);
+      b->tmpKeys = getMem(sizeof(unsigned long long) * b->pairCapacity);
+      b->pairLocs = getMem(sizeof(unsigned int) * b->pairCapacity);
+      b->tmpLocs = getMem(sizeof(unsigned int) * b->pairCapacity);
+    }
+
+  n = 0;
+  initIHashRoller(&roller);
+  initIHashMinimizer(&mz, 1);
+  for (i=0; l > 0 && i < l + WINDOW_SIZE - 1; i++)
+    {
+      hv = rollIHashVal(&roller, refGen[i]);
+      for (s=0; s < seedLoops; s++)
+	{
+	  // Don't care positions of a spaced seed may hold any character
+	  if (seedCnt)
+	    hv = (i >= WINDOW_SIZE - 1) ? hashSeedVal(refGen + i - WINDOW_SIZE + 1, s) : -1;
+	  if (hv == -1)
+	    continue;
+	  if (!indexMinimizer)
+	    {
+	      b->keys[n] = hv;
+	      b->pairLocs[n++] = i - WINDOW_SIZE + 2;
+	    }
+	  else if (pushIHashMinimizer(&mz, hv, i - WINDOW_SIZE + 2, &b->keys[n], &b->pairLocs[n]))
+	    n++;
+	}
+    }
+
+  sortKHashTablePairs(b->keys, b->pairLocs, b->tmpKeys, b->tmpLocs, n);
+  saveKHashTable(b->keys, b->pairLocs, n, refGen, refGenName, refGenOff);
+}
+/**********************************************/
+void generateKHashTable(char *fileName, char *indexName)
+{
+  double		startTime		= getTime();
+  IHashTableBuild	build;
+  char			*refGenName;
+  char			*refGen;
+  int			refGenOff		= 0;
+  int			flag;
+
+  if (!initLoadingRefGenome(fileName))
+    return;
+  initSavingIHashTable(indexName);
+  memset(&build, 0, sizeof(build));
+
+  fprintf(stderr, "Generating Index from %s", fileName);
+  fflush(stderr);
+
+  char *prev = getMem (CONTIG_NAME_SIZE);
+  prev[0]='\0';
+
+  do
+    {
+      flag = loadRefGenome (&refGen, &refGenName, &refGenOff);
+
+      if (indexAppendMode && isIHashTableChunkIndexed(refGenName))
+	continue;
+
+      printIHashTableProgress(prev, refGenName);
+      indexKHashTableChunk(&build, refGen, refGenName, refGenOff);
+    } while (flag);
+
+  freeMem(prev, CONTIG_NAME_SIZE);
+  freeIHashTableBuild(&build);
+
+  finalizeLoadingRefGenome();
+  finalizeSavingIHashTable();
+
+  fprintf(stderr, "\nDONE in %0.2fs!\n", (getTime()-startTime));
+}
+/**********************************************/
+// Index being written by generateMultiHashTable, swapped in and out of the
+// saving state for every window size
+typedef struct
+{
+  FILE		*fp;
+  IndexChunk	*chunks;
+  unsigned int	chunkCnt;
+  unsigned int	chunkCapacity;
+} IHashTableOutput;
+
+void swapIHashTableOutput(IHashTableOutput *out)
+{
+  IHashTableOutput tmp = { _ih_fp, _ih_chunks, _ih_chunkCnt, _ih_chunkCapacity };
+
+  _ih_fp = out->fp;
+  _ih_chunks = out->chunks;
+  _ih_chunkCnt = out->chunkCnt;
+  _ih_chunkCapacity = out->chunkCapacity;
+  *out = tmp;
+}
+/**********************************************/
+// One index per --ws window size from a single pass over the reference:
+// every chunk is loaded once and hashed for each window size into its own
+// <fasta>.ws<size>.index
+void generateMultiHashTable(char *fileName, char *indexName)
+{
+  double		startTime		= getTime();
+  IHashTableOutput	*outs			= getMem(sizeof(IHashTableOutput) * windowSizeCnt);
+  IHashTableBuild	build;
+  char			name[FILE_NAME_LENGTH];
+  char			*refGenName;
+  char			*refGen;
+  int			refGenOff		= 0;
+  int			flag, k;
+
+  if (!initLoadingRefGenome(fileName))
+    return;
+  memset(&build, 0, sizeof(build));
+  memset(outs, 0, sizeof(IHashTableOutput) * windowSizeCnt);
+  for (k=0; k<windowSizeCnt; k++)
+    {
+      if (snprintf(name, FILE_NAME_LENGTH, "%s.ws%d.index", fileName, windowSizes[k]) >= FILE_NAME_LENGTH)
+	{
+	  fprintf(stderr, "Error: The index name of %s is too long.\n", fileName);
+	  exit(0);
+	}
+      initSavingIHashTable(name);
+      swapIHashTableOutput(&outs[k]);
+    }
+
+  fprintf(stderr, "Generating Index from %s", fileName);
+  fflush(stderr);
+
+  char *prev = getMem (CONTIG_NAME_SIZE);
+  prev[0]='\0';
+
+  do
+    {
+      flag = loadRefGenome (&refGen, &refGenName, &refGenOff);
+
+      printIHashTableProgress(prev, refGenName);
+      for (k=0; k<windowSizeCnt; k++)
+	{
+	  WINDOW_SIZE = windowSizes[k];
+	  swapIHashTableOutput(&outs[k]);
+	  if (IH_KEYS64)
+	    indexKHashTableChunk(&build, refGen, refGenName, refGenOff);
+	  else
+	    indexIHashTableChunk(&build, refGen, refGenName, refGenOff);
+	  swapIHashTableOutput(&outs[k]);
+	}
+    } while (flag);
+
+  freeMem(prev, CONTIG_NAME_SIZE);
+  freeIHashTableBuild(&build);
+  finalizeLoadingRefGenome();
+
+  for (k=0; k<windowSizeCnt; k++)
+    {
+      WINDOW_SIZE = windowSizes[k];
+      swapIHashTableOutput(&outs[k]);
+      finalizeSavingIHashTable();
+      fprintf(stderr, "\n - %s.ws%d.index", fileName, windowSizes[k]);
+    }
+  freeMem(outs, sizeof(IHashTableOutput) * windowSizeCnt);
+
+  fprintf(stderr, "\nDONE in %0.2fs!\n", (getTime()-startTime));
+}
+/**********************************************/
+void finalizeLoadingKHashTable()
+{
+  finalizeIHashTableSlots();
+  if (_ih_map != _ih_residentMap)
+    munmap(_ih_map, _ih_mapSize);
+  _ih_map = NULL;
+  _ih_chunks = NULL;
+  fclose(_ih_fp);
+}
+/**********************************************/
+int loadKHashTable(double *loadTime)
+{
+  double startTime = getTime();
+  IndexChunk *chunk;
+  IHashTableSlot *slot;
+  unsigned int k, p;
+  int next = nextIHashTableChunk();
+
+  if (next < 0)
+    return 0;
+
+  slot = useIHashTableSlot(next);
+  _ih_curChunk = next;
+  chunk = &_ih_chunks[_ih_curChunk];
+
+  _ih_refGenOff = chunk->refGenOffset;
+  loadIHashTableOverflow(chunk);
+  _ih_curKeys64 = (unsigned long long *)(slot->base + chunk->refBytes);
+
+  if (_ih_flags & INDEX_FLAG_COMPRESSED)
+    {
+      _ih_curStarts = slot->starts;
+      _ih_curLocs = slot->locBuf;
+    }
+  else
+    {
+      _ih_curStarts = (unsigned int *)(_ih_curKeys64 + chunk->keyCnt);
+      _ih_curLocs = slot->locs;
+    }
+
+  _ih_keyPrefixShift = (getIHashKeyBits() > 16) ? getIHashKeyBits() - 16 : 0;
+  for (k=0, p=0; p <= (1<<16); p++)
+    {
+      while (k < chunk->keyCnt && (_ih_curKeys64[k] >> _ih_keyPrefixShift) < p)
+	k++;
+      _ih_keyPrefix[p] = k;
+    }
+
+  startIHashTablePrefetch();
+  *loadTime = getTime()-startTime;
+  return 1;
+}
+/**********************************************/
+unsigned int *getKHashTableCandidates(long long hv)
+{
+  unsigned int lo, hi, mid;
+
+  if (hv == -1)
+    return NULL;
+
+  lo = _ih_keyPrefix[hv >> _ih_keyPrefixShift];
+  hi = _ih_keyPrefix[(hv >> _ih_keyPrefixShift) + 1];
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (_ih_curKeys64[mid] < hv)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  if (lo < _ih_keyPrefix[(hv >> _ih_keyPrefixShift) + 1] && _ih_curKeys64[lo] == hv)
+    return _ih_curLocs + _ih_curStarts[lo];
+  return NULL;
+}
+/**********************************************/
+/* External memory build (--index-mem)        */
+/**********************************************/
+// The (key, location) pairs of a chunk are generated in runs that fit in
+// indexMemory, radix sorted and spilled to a temporary file next to the
+// index. Merging the runs fills one temporary file per section of the chunk;
+// the sections are copied into the index afterwards. The index is the same
+// as the one of the in-memory build.
+
+#define EH_GV_BATCH	4096			// Multiple of four
+
+typedef struct
+{
+  unsigned long long	*keys;			// Buffered pairs of the run
+  unsigned int		*locs;
+  unsigned int		bufCnt;
+  unsigned int		bufPos;
+  unsigned int		left;			// Pairs of the run still on disk
+  long long		keysOffset;		// First of them in the run file
+  long long		locsOffset;
+} EHashTableRun;
+
+typedef struct
+{
+  FILE			*keys;
+  FILE			*starts;		// Starts or coded running location counts
+  FILE			*lists;
+  FILE			*overflow;		// [count, locs] of the keys above maxKeyFrequency
+  unsigned int		gvKeys[EH_GV_BATCH];	// Values waiting for the group varint coder
+  unsigned int		gvStarts[EH_GV_BATCH];
+  unsigned int		gvKeyCnt;
+  unsigned int		gvStartCnt;
+  unsigned int		prevKey;
+  unsigned int		prevStart;
+  unsigned int		keyCnt;
+  unsigned int		locCnt;
+  unsigned int		pos;
+  unsigned long long	locBytes;
+  IHashTableOverflow	*ov;
+  unsigned int		ovCnt;
+  unsigned int		ovCapacity;
+  unsigned char		*buf;
+  unsigned int		bufSize;
+} EHashTableStream;
+
+char		*_eh_indexName		= NULL;
+/**********************************************/
+FILE *openEHashTableTemp()
+{
+  char name[FILE_NAME_LENGTH];
+  FILE *fp = NULL;
+  int fd;
+
+  snprintf(name, FILE_NAME_LENGTH, "%s.tmpXXXXXX", _eh_indexName);
+  fd = mkstemp(name);
+  if (fd >= 0)
+    fp = fdopen(fd, "w+");
+  if (fp == NULL)
+    {
+      fprintf(stderr, "Error: Cannot create a temporary file next to %s\n", _eh_indexName);
+      exit(0);
+    }
+  unlink(name);
+  return fp;
+}
+/**********************************************/
+// Appends the content of a temporary file to the index
+void copyEHashTableTemp(FILE *fp)
+{
+  char buf[1<<16];
+  size_t n;
+
+  fflush(fp);
+  rewind(fp);
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    if (fwrite(buf, 1, n, _ih_fp) != n)
+      fprintf(stderr, "Write error while saving hash table.\n");
+  fclose(fp);
+}
+/**********************************************/
+void flushEHashTableGV(EHashTableStream *s, FILE *fp, unsigned int *vals, unsigned int *cnt, unsigned int *prev)
+{
+  unsigned char out[5*EH_GV_BATCH];
+  unsigned char *end = encodeGroupVarintFrom(vals, *cnt, out, *prev);
+
+  if (*cnt > 0)
+    *prev = vals[*cnt-1];
+  *cnt = 0;
+  if (end > out && fwrite(out, 1, end - out, fp) == 0)
+    fprintf(stderr, "Write error while saving hash table.\n");
+  s->locBytes += end - out;
+}
+/**********************************************/
+void initEHashTableStream(EHashTableStream *s)
+{
+  memset(s, 0, sizeof(EHashTableStream));
+  s->keys = openEHashTableTemp();
+  s->starts = openEHashTableTemp();
+  s->lists = openEHashTableTemp();
+  s->overflow = openEHashTableTemp();
+}
+/**********************************************/
+// Adds the sorted locations of one key in key order
+void addEHashTableKey(EHashTableStream *s, unsigned long long key, unsigned int *locs, unsigned int cnt)
+{
+  int tmp;
+  unsigned int key32 = key;
+
+  if (maxKeyFrequency > 0 && cnt > maxKeyFrequency)
+    {
+      s->ov = addIHashTableOverflow(s->ov, &s->ovCnt, &s->ovCapacity);
+      s->ov[s->ovCnt-1].key = key;
+      s->ov[s->ovCnt-1].locs = NULL;
+      s->ov[s->ovCnt-1].cnt = cnt;
+      tmp = fwrite(&cnt, sizeof(cnt), 1, s->overflow);
+      tmp = fwrite(locs, sizeof(unsigned int), cnt, s->overflow);
+      return;
+    }
+
+  s->keyCnt++;
+  s->locCnt += cnt;
+
+  if (IH_KEYS64)
+    tmp = fwrite(&key, sizeof(key), 1, s->keys);
+  else if (!indexCompressed)
+    tmp = fwrite(&key32, sizeof(key32), 1, s->keys);
+  else
+    {
+      s->gvKeys[s->gvKeyCnt++] = key32;
+      if (s->gvKeyCnt == EH_GV_BATCH)
+	flushEHashTableGV(s, s->keys, s->gvKeys, &s->gvKeyCnt, &s->prevKey);
+    }
+
+  if (indexCompressed)
+    {
+      s->gvStarts[s->gvStartCnt++] = s->locCnt;
+      if (s->gvStartCnt == EH_GV_BATCH)
+	flushEHashTableGV(s, s->starts, s->gvStarts, &s->gvStartCnt, &s->prevStart);
+
+      if (5 * cnt + 32 > s->bufSize)
+	{
+	  if (s->buf != NULL)
+	    freeMem(s->buf, s->bufSize);
+	  s->bufSize = 5 * cnt + 32;
+	  s->buf = getMem(s->bufSize);
+	}
+      unsigned char *end = encodeGroupVarint(locs, cnt, s->buf);
+      tmp = fwrite(s->buf, 1, end - s->buf, s->lists);
+      s->locBytes += end - s->buf;
+    }
+  else
+    {
+      tmp = fwrite(&s->pos, sizeof(s->pos), 1, s->starts);
+      s->pos += cnt + 1;
+      tmp = fwrite(&cnt, sizeof(cnt), 1, s->lists);
+      tmp = fwrite(locs, sizeof(unsigned int), cnt, s->lists);
+    }
+
+  if (tmp == 0)
+    fprintf(stderr, "Write error while saving hash table.\n");
+}
+/**********************************************/
+// Writes the chunk in the layout of saveIHashTable / saveKHashTable
+void saveEHashTable(EHashTableStream *s, char *refGen, char *refGenName, int refGenOffset)
+{
+  int tmp = 1;
+  unsigned int k, pos = 0;
+  IndexChunk *chunk = addIHashTableChunk();
+
+  snprintf(chunk->name, CONTIG_NAME_SIZE, "%s", refGenName);
+  chunk->refGenOffset = refGenOffset;
+  chunk->keyCnt = s->keyCnt;
+  chunk->locCnt = s->locCnt;
+  chunk->offset = ftello(_ih_fp);
+
+  saveIHashTableRef(chunk, refGen);
+
+  if (indexCompressed)
+    {
+      if (!IH_KEYS64)
+	flushEHashTableGV(s, s->keys, s->gvKeys, &s->gvKeyCnt, &s->prevKey);
+      flushEHashTableGV(s, s->starts, s->gvStarts, &s->gvStartCnt, &s->prevStart);
+    }
+  copyEHashTableTemp(s->keys);
+  copyEHashTableTemp(s->starts);
+  copyEHashTableTemp(s->lists);
+
+  if (indexCompressed)
+    {
+      // Slack for the 16 byte loads of the decoder
+      char zero[16] = {0};
+      tmp = fwrite(zero, 1, 16, _ih_fp);
+      chunk->locBytes = s->locBytes + 16;
+    }
+  writeIHashTablePadding();
+
+  chunk->overflowOffset = ftello(_ih_fp);
+  chunk->overflowKeyCnt = s->ovCnt;
+  for (k=0; k<s->ovCnt; k++)
+    tmp = fwrite(&s->ov[k].key, sizeof(unsigned long long), 1, _ih_fp);
+  for (k=0; k<s->ovCnt; k++)
+    {
+      tmp = fwrite(&pos, sizeof(pos), 1, _ih_fp);
+      pos += s->ov[k].cnt + 1;
+      chunk->overflowLocCnt += s->ov[k].cnt;
+    }
+  copyEHashTableTemp(s->overflow);
+  writeIHashTablePadding();
+
+  if (s->ov != NULL)
+    freeMem(s->ov, sizeof(IHashTableOverflow) * s->ovCapacity);
+  if (s->buf != NULL)
+    freeMem(s->buf, s->bufSize);
+
+  if (tmp == 0)
+    fprintf(stderr, "Write error while saving hash table.\n");
+}
+/**********************************************/
+void spillEHashTableRun(FILE *fp, EHashTableRun *run, unsigned long long *keys, unsigned int *locs, unsigned long long *tmpKeys, unsigned int *tmpLocs, unsigned int n)
+{
+  sortKHashTablePairs(keys, locs, tmpKeys, tmpLocs, n);
+  run->left = n;
+  run->keysOffset = ftello(fp);
+  run->locsOffset = run->keysOffset + sizeof(unsigned long long) * n;
+  if (fwrite(keys, sizeof(unsigned long long), n, fp) != n || fwrite(locs, sizeof(unsigned int), n, fp) != n)
+    {
+      fprintf(stderr, "Write error while spilling the index.\n");
+      exit(0);
+    }
+}
+/**********************************************/
+// Refills the buffer of a run; 0 when the run is exhausted
+int fillEHashTableRun(FILE *fp, EHashTableRun *run, unsigned int bufSize)
+{
+  unsigned int n = (run->left < bufSize) ? run->left : bufSize;
+  int tmp;
+
+  if (n == 0)
+    return 0;
+  fseeko(fp, run->keysOffset, SEEK_SET);
+  tmp = fread(run->keys, sizeof(unsigned long long), n, fp);
+  fseeko(fp, run->locsOffset, SEEK_SET);
+  tmp += fread(run->locs, sizeof(unsigned int), n, fp);
+  if (tmp != 2*n)
+    {
+      fprintf(stderr, "Read error while merging the index.\n");
+      exit(0);
+    }
+  run->keysOffset += sizeof(unsigned long long) * n;
+  run->locsOffset += sizeof(unsigned int) * n;
+  run->left -= n;
+  run->bufCnt = n;
+  run->bufPos = 0;
+  return 1;
+}
+/**********************************************/
+// Runs hold increasing locations, so ties go to the earlier run
+int lessEHashTableRun(EHashTableRun *runs, int a, int b)
+{
+  unsigned long long ka = runs[a].keys[runs[a].bufPos];
+  unsigned long long kb = runs[b].keys[runs[b].bufPos];
+  return (ka < kb) || (ka == kb && a < b);
+}
+/**********************************************/
+void siftEHashTableHeap(EHashTableRun *runs, int *heap, int n, int i)
+{
+  int c, t;
+
+  while ((c = 2*i+1) < n)
+    {
+      if (c+1 < n && lessEHashTableRun(runs, heap[c+1], heap[c]))
+	c++;
+      if (!lessEHashTableRun(runs, heap[c], heap[i]))
+	break;
+      t = heap[i]; heap[i] = heap[c]; heap[c] = t;
+      i = c;
+    }
+}
+/**********************************************/
+// Merges the runs and hands every key with all its locations to the stream
+void mergeEHashTableRuns(FILE *fp, EHashTableRun *runs, int runCnt, unsigned int bufSize, EHashTableStream *s)
+{
+  int *heap = getMem(sizeof(int) * runCnt);
+  unsigned int *group = NULL;
+  unsigned int groupCnt = 0, groupCapacity = 0;
+  unsigned long long key = 0;
+  int i, n = 0;
+  EHashTableRun *r;
+
+  for (i=0; i<runCnt; i++)
+    if (runs[i].bufPos < runs[i].bufCnt || fillEHashTableRun(fp, &runs[i], bufSize))
+      heap[n++] = i;
+  for (i=n/2-1; i>=0; i--)
+    siftEHashTableHeap(runs, heap, n, i);
+
+  while (n > 0)
+    {
+      r = &runs[heap[0]];
+      if (groupCnt > 0 && r->keys[r->bufPos] != key)
+	{
+	  addEHashTableKey(s, key, group, groupCnt);
+	  groupCnt = 0;
+	}
+      if (groupCnt == groupCapacity)
+	{
+	  unsigned int newCapacity = (groupCapacity == 0) ? 1024 : 2 * groupCapacity;
+	  unsigned int *tmp = getMem(sizeof(unsigned int) * newCapacity);
+	  if (group != NULL)
+	    {
+	      memcpy(tmp, group, sizeof(unsigned int) * groupCnt);
+	      freeMem(group, sizeof(unsigned int) * groupCapacity);
+	    }
+	  group = tmp;
+	  groupCapacity = newCapacity;
+	}
+      key = r->keys[r->bufPos];
+      group[groupCnt++] = r->locs[r->bufPos++];
+
+      if (r->bufPos == r->bufCnt && !fillEHashTableRun(fp, r, bufSize))
+	heap[0] = heap[--n];
+      siftEHashTableHeap(runs, heap, n, 0);
+    }
+  if (groupCnt > 0)
+    addEHashTableKey(s, key, group, groupCnt);
+
+  if (group != NULL)
+    freeMem(group, sizeof(unsigned int) * groupCapacity);
+  freeMem(heap, sizeof(int) * runCnt);
+}
+/**********************************************/
+void generateEHashTable(char *fileName, char *indexName)
+{
+  double		startTime		= getTime();
+  unsigned long long	runSize			= (unsigned long long)indexMemory * 1048576 / 24;
+  unsigned long long	*keys			= NULL;
+  unsigned long long	*tmpKeys		= NULL;
+  unsigned int		*locs			= NULL;
+  unsigned int		*tmpLocs		= NULL;
+  unsigned int		capacity		= 0;
+  unsigned int		n, bufSize, runCapacity;
+  EHashTableRun		*runs;
+  EHashTableStream	stream;
+  IHashRoller		roller;
+  IHashMinimizer	mz;
+  unsigned long long	key;
+  unsigned int		loc;
+  FILE			*runFp;
+  char			*refGenName;
+  char			*refGen;
+  int			refGenOff		= 0;
+  int			i, l, flag, runCnt, s;
+  int			seedLoops		= (seedCnt) ? seedCnt : 1;
+  long long		hv;
+
+  if (!initLoadingRefGenome(fileName))
+    return;
+  initSavingIHashTable(indexName);
+  _eh_indexName = indexName;
+
+  fprintf(stderr, "Generating Index from %s", fileName);
+  fflush(stderr);
+
+  char *prev = getMem (CONTIG_NAME_SIZE);
+  prev[0]='\0';
+
+  do
+    {
+      flag = loadRefGenome (&refGen, &refGenName, &refGenOff);
+
+      if (indexAppendMode && isIHashTableChunkIndexed(refGenName))
+	continue;
+
+      if ( strcmp(prev, refGenName) != 0)
+	{
+	  fprintf(stderr, "\n - %s ", refGenName);
+	  fflush(stderr);
+	  sprintf(prev, "%s", refGenName);
+	}
+      else
+	{
+	  fprintf(stderr, ".");
+	  fflush(stderr);
+	}
+
+      l = strlen(refGen) - WINDOW_SIZE;
+      if (l < 0)
+	l = 0;
+
+      if (l * seedLoops > capacity && capacity < runSize)
+	{
+	  if (keys != NULL)
+	    {
+	      freeMem(keys, sizeof(unsigned long long) * capacity);
+	      freeMem(tmpKeys, sizeof(unsigned long long) * capacity);
+	      freeMem(locs, sizeof(unsigned int) * capacity);
+	      freeMem(tmpLocs, sizeof(unsigned int) * capacity);
+	    }
+	  capacity = (l * seedLoops < runSize) ? l * seedLoops : runSize;
+	  keys = getMem(sizeof(unsigned long long) * capacity);
+	  tmpKeys = getMem(sizeof(unsigned long long) * capacity);
+	  locs = getMem(sizeof(unsigned int) * capacity);
+	  tmpLocs = getMem(sizeof(unsigned int) * capacity);
+	}
+
+      runCapacity = (capacity > 0) ? l * seedLoops / capacity + 2 : 2;
+      runs = getMem(sizeof(EHashTableRun) * runCapacity);
+      runFp = NULL;
+      runCnt = 0;
+      n = 0;
+      initIHashRoller(&roller);
+      initIHashMinimizer(&mz, 1);
+      for (i=0; l > 0 && i < l + WINDOW_SIZE - 1; i++)
+	{
+	  hv = rollIHashVal(&roller, refGen[i]);
+	  for (s=0; s < seedLoops; s++)
+	    {
+	      if (seedCnt)
+		hv = (i >= WINDOW_SIZE - 1) ? hashSeedVal(refGen + i - WINDOW_SIZE + 1, s) : -1;
+	      if (hv == -1)
+		continue;
+	      key = hv;
+	      loc = i - WINDOW_SIZE + 2;
+	      if (indexMinimizer && !pushIHashMinimizer(&mz, hv, loc, &key, &loc))
+		continue;
+	      if (n == capacity)
+		{
+		  if (runFp == NULL)
+		    runFp = openEHashTableTemp();
+		  spillEHashTableRun(runFp, &runs[runCnt++], keys, locs, tmpKeys, tmpLocs, n);
+		  n = 0;
+		}
+	      keys[n] = key;
+	      locs[n++] = loc;
+	    }
+	}
+
+      initEHashTableStream(&stream);
+      if (runFp == NULL)
+	{
+	  // The chunk fits in memory
+	  sortKHashTablePairs(keys, locs, tmpKeys, tmpLocs, n);
+	  memset(&runs[0], 0, sizeof(EHashTableRun));
+	  runs[0].keys = keys;
+	  runs[0].locs = locs;
+	  runs[0].bufCnt = n;
+	  runCnt = 1;
+	  bufSize = n;
+	}
+      else
+	{
+	  if (n > 0)
+	    spillEHashTableRun(runFp, &runs[runCnt++], keys, locs, tmpKeys, tmpLocs, n);
+
+	  // The run buffers share the pair arrays
+	  bufSize = capacity / runCnt;
+	  if (bufSize == 0)
+	    bufSize = 1;
+	  if (bufSize * runCnt > capacity)
+	    {
+	      fprintf(stderr, "\nError: --index-mem is too small for this reference.\n");
+	      exit(0);
+	    }
+	  for (i=0; i<runCnt; i++)
+	    {
+	      runs[i].keys = keys + i * bufSize;
+	      runs[i].locs = locs + i * bufSize;
+	      runs[i].bufCnt = runs[i].bufPos = 0;
+	    }
+	}
+      mergeEHashTableRuns(runFp, runs, runCnt, bufSize, &stream);
+      saveEHashTable(&stream, refGen, refGenName, refGenOff);
+
+      if (runFp != NULL)
+	fclose(runFp);
+      freeMem(runs, sizeof(EHashTableRun) * runCapacity);
+    } while (flag);
+
+  freeMem(prev, CONTIG_NAME_SIZE);
+  if (keys != NULL)
+    {
+      freeMem(keys, sizeof(unsigned long long) * capacity);
+      freeMem(tmpKeys, sizeof(unsigned long long) * capacity);
+      freeMem(locs, sizeof(unsigned int) * capacity);
+      freeMem(tmpLocs, sizeof(unsigned int) * capacity);
+    }
+
+  finalizeLoadingRefGenome();
+  finalizeSavingIHashTable();
+
+  fprintf(stderr, "\nDONE in %0.2fs!\n", (getTime()-startTime));
+}
+/**********************************************/
+/* FM-index for variable length seeds         */
+/**********************************************/
+// Every chunk holds the BWT of its reference in blocks of 64 rows (ACGT as
+// two bit planes, a mask of the rows preceded by anything else and a mask
+// of the sampled rows, with the counts before the block) and the text
+// positions of the sampled rows. A row is sampled when its position is a
+// multiple of INDEX_FM_SAMPLE or it cannot be walked back with LF.
+
+typedef struct
+{
+  unsigned int		occ[4];			// A, C, G, T before the block
+  unsigned int		sampled;		// Sampled rows before the block
+  unsigned int		pad;
+  unsigned long long	lo;			// Low and high bits of the ACGT codes
+  unsigned long long	hi;
+  unsigned long long	other;			// Sentinel or non ACGT
+  unsigned long long	smp;
+} FMBlock;
+
+#define FM_BUFFER_CNT	(2 * (SEQ_MAX_LENGTH / 11 + 1))	// Location lists alive at once
+
+unsigned int	*_fm_C			= NULL;		// Rows before the suffixes starting with A, C, G, T
+FMBlock		*_fm_blocks		= NULL;
+unsigned int	*_fm_samples		= NULL;
+unsigned int	_fm_n			= 0;		// Rows, the sentinel included
+unsigned int	*_fm_buf[FM_BUFFER_CNT];		// Location lists handed out by the lookups
+unsigned int	_fm_bufSize[FM_BUFFER_CNT];
+int		_fm_bufNext		= 0;
+/**********************************************/
+/* Suffix array construction by induced sorting (SA-IS, Nong et al. 2009).
+   s holds n symbols (bytes at the top level, ints in the recursion) that
+   end with the unique smallest symbol 0. */
+#define FM_CHR(i)	((cs == sizeof(int)) ? ((int *)s)[i] : ((unsigned char *)s)[i])
+#define FM_TGET(i)	((t[(i)>>3] >> ((i)&7)) & 1)
+#define FM_TSET(i, b)	(t[(i)>>3] = (b) ? (t[(i)>>3] | (1 << ((i)&7))) : (t[(i)>>3] & ~(1 << ((i)&7))))
+#define FM_LMS(i)	((i) > 0 && FM_TGET(i) && !FM_TGET((i)-1))
+
+void getFMIndexBuckets(void *s, int *bkt, int n, int K, int cs, int end)
+{
+  int i, sum = 0;
+
+  memset(bkt, 0, sizeof(int) * (K+1));
+  for (i=0; i<n; i++)
+    bkt[FM_CHR(i)]++;
+  for (i=0; i<=K; i++)
+    {
+      sum += bkt[i];
+      bkt[i] = (end) ? sum : sum - bkt[i];
+    }
+}
+/**********************************************/
+void induceFMIndexSuffixes(unsigned char *t, int *SA, void *s, int *bkt, int n, int K, int cs)
+{
+  int i, j;
+
+  getFMIndexBuckets(s, bkt, n, K, cs, 0);
+  for (i=0; i<n; i++)
+    {
+      j = SA[i] - 1;
+      if (j >= 0 && !FM_TGET(j))
+	SA[bkt[FM_CHR(j)]++] = j;
+    }
+  getFMIndexBuckets(s, bkt, n, K, cs, 1);
+  for (i=n-1; i>=0; i--)
+    {
+      j = SA[i] - 1;
+      if (j >= 0 && FM_TGET(j))
+	SA[--bkt[FM_CHR(j)]] = j;
+    }
+}
+/**********************************************/
+void sortFMIndexSuffixes(void *s, int *SA, int n, int K, int cs)
+{
+  unsigned char *t = getMem(n/8 + 1);
+  int *bkt = getMem(sizeof(int) * (K+1));
+  int i, j, d, n1 = 0, name = 0, prev = -1, pos, diff;
+
+  // S (1) and L (0) suffixes
+  FM_TSET(n-2, 0);
+  FM_TSET(n-1, 1);
+  for (i=n-3; i>=0; i--)
+    FM_TSET(i, (FM_CHR(i) < FM_CHR(i+1) || (FM_CHR(i) == FM_CHR(i+1) && FM_TGET(i+1))) ? 1 : 0);
+
+  // Sort the LMS substrings
+  getFMIndexBuckets(s, bkt, n, K, cs, 1);
+  for (i=0; i<n; i++)
+    SA[i] = -1;
+  for (i=1; i<n; i++)
+    if (FM_LMS(i))
+      SA[--bkt[FM_CHR(i)]] = i;
+  induceFMIndexSuffixes(t, SA, s, bkt, n, K, cs);
+
+  // Name them; equal substrings get equal names
+  for (i=0; i<n; i++)
+    if (FM_LMS(SA[i]))
+      SA[n1++] = SA[i];
+  for (i=n1; i<n; i++)
+    SA[i] = -1;
+  for (i=0; i<n1; i++)
+    {
+      pos = SA[i];
+      diff = 0;
+      for (d=0; d<n; d++)
+	{
+	  if (prev == -1 || FM_CHR(pos+d) != FM_CHR(prev+d) || FM_TGET(pos+d) != FM_TGET(prev+d))
+	    {
+	      diff = 1;
+	      break;
+	    }
+	  else if (d > 0 && (FM_LMS(pos+d) || FM_LMS(prev+d)))
+	    break;
+	}
+      if (diff)
+	{
+	  name++;
+	  prev = pos;
+	}
+      SA[n1 + pos/2] = name - 1;
+    }
+  for (i=n-1, j=n-1; i>=n1; i--)
+    if (SA[i] >= 0)
+      SA[j--] = SA[i];
+
+  // Sort the reduced string, recursively if the names are not unique
+  int *SA1 = SA, *s1 = SA + n - n1;
+  if (name < n1)
+    sortFMIndexSuffixes(s1, SA1, n1, name-1, sizeof(int));
+  else
+    for (i=0; i<n1; i++)
+      SA1[s1[i]] = i;
+
+  // Induce the suffix array from the sorted LMS suffixes
+  getFMIndexBuckets(s, bkt, n, K, cs, 1);
+  for (i=1, j=0; i<n; i++)
+    if (FM_LMS(i))
+      s1[j++] = i;
+  for (i=0; i<n1; i++)
+    SA1[i] = s1[SA1[i]];
+  for (i=n1; i<n; i++)
+    SA[i] = -1;
+  for (i=n1-1; i>=0; i--)
+    {
+      j = SA[i];
+      SA[i] = -1;
+      SA[--bkt[FM_CHR(j)]] = j;
+    }
+  induceFMIndexSuffixes(t, SA, s, bkt, n, K, cs);
+
+  freeMem(bkt, sizeof(int) * (K+1));
+  freeMem(t, n/8 + 1);
+}
+/**********************************************/
+void saveFMIndex(char *refGen, char *refGenName, int refGenOffset)
+{
+  int tmp;
+  IndexChunk *chunk = addIHashTableChunk();
+  unsigned int len = strlen(refGen), n = len + 1;
+  unsigned int blockCnt = n/64 + 1, sampleCnt = 0;
+  unsigned char *text = getMem(n);
+  int *SA = getMem(sizeof(int) * n);
+  FMBlock *blocks = getMem(sizeof(FMBlock) * blockCnt);
+  unsigned int C[4] = {0}, occ[4] = {0};
+  unsigned int i, b, c, r;
+  int code;
+
+  snprintf(chunk->name, CONTIG_NAME_SIZE, "%s", refGenName);
+  chunk->refGenOffset = refGenOffset;
+  chunk->offset = ftello(_ih_fp);
+
+  saveIHashTableRef(chunk, refGen);
 
-  if (hashTable[hv].locs == NULL)
+  // Sentinel 0, ACGT 1..4, everything else 5
+  for (i=0; i<len; i++)
     {
-      sizeInc = 1;
-      hashTable[hv].locs = getMem (sizeof(unsigned int)*2);
-      hashTable[hv].locs[0]=1;
-      hashTable[hv].locs[1]=location;
+      code = _ih_code[(unsigned char)refGen[i]];
+      text[i] = (code < 0) ? 5 : code + 1;
+      if (code >= 0)
+	C[code]++;
     }
-  else
+  text[len] = 0;
+  for (c=0, r=1; c<4; c++)
     {
-      int size = hashTable[hv].locs[0];
-      int i;
-      unsigned int *tmp = getMem( (size + 2) * sizeof(unsigned int) );
+      unsigned int cnt = C[c];
+      C[c] = r;
+      r += cnt;
+    }
+
+  if (n > 1)
+    sortFMIndexSuffixes(text, SA, n, 5, sizeof(unsigned char));
+  else
+    SA[0] = 0;
 
-      for (i = 0; i <= size; i++)
+  memset(blocks, 0, sizeof(FMBlock) * blockCnt);
+  for (i=0; i<n; i++)
+    {
+      b = i >> 6;
+      r = i & 63;
+      if (r == 0)
 	{
-	  tmp[i] = hashTable[hv].locs[i];
+	  memcpy(blocks[b].occ, occ, sizeof(occ));
+	  blocks[b].sampled = sampleCnt;
 	}
-      size++;
-      tmp[0] = size;
-      tmp[size] = location;
-		
-      freeMem(hashTable[hv].locs, (hashTable[hv].locs[0]*(sizeof(unsigned int))));
-      hashTable[hv].locs = tmp;
+      c = (SA[i] > 0) ? text[SA[i]-1] : 0;
+      if (c >= 1 && c <= 4)
+	{
+	  c--;
+	  blocks[b].lo |= (unsigned long long)(c & 1) << r;
+	  blocks[b].hi |= (unsigned long long)(c >> 1) << r;
+	  occ[c]++;
+	  if (SA[i] % INDEX_FM_SAMPLE == 0)
+	    {
+	      blocks[b].smp |= 1ULL << r;
+	      SA[sampleCnt++] = SA[i];
+	    }
+	}
+      else
+	{
+	  blocks[b].other |= 1ULL << r;
+	  blocks[b].smp |= 1ULL << r;
+	  SA[sampleCnt++] = SA[i];
+	}
+    }
+  if ((n & 63) == 0)
+    {
+      memcpy(blocks[n >> 6].occ, occ, sizeof(occ));
+      blocks[n >> 6].sampled = sampleCnt;
     }
-  return sizeInc;
+
+  chunk->keyCnt = sampleCnt;
+  chunk->locCnt = n;
+  chunk->locBytes = sizeof(C) + sizeof(FMBlock) * blockCnt + sizeof(unsigned int) * sampleCnt;
+
+  tmp = fwrite(C, sizeof(C), 1, _ih_fp);
+  tmp = fwrite(blocks, sizeof(FMBlock), blockCnt, _ih_fp);
+  tmp = fwrite(SA, sizeof(int), sampleCnt, _ih_fp);
+  writeIHashTablePadding();
+
+  freeMem(text, n);
+  freeMem(SA, sizeof(int) * n);
+  freeMem(blocks, sizeof(FMBlock) * blockCnt);
+
+  if (tmp == 0)
+    fprintf(stderr, "Write error while saving hash table.\n");
 }
 /**********************************************/
-void generateIHashTable(char *fileName, char *indexName)
+void generateFMIndex(char *fileName, char *indexName)
 {
-  double          startTime           = getTime();
-  unsigned int	hashTableSize		= 0;
-  unsigned int 	hashTableMaxSize	= pow(4, WINDOW_SIZE);
-  IHashTable		*hashTable			= getMem(sizeof(IHashTable)*hashTableMaxSize);
-  char 			*refGenName;
-  char			*refGen;
-  int				refGenOff			= 0;
-  int i, hv, l, flag;
-
+  double	startTime		= getTime();
+  char		*refGenName;
+  char		*refGen;
+  int		refGenOff		= 0;
+  int		flag;
 
-  for ( i = 0; i < hashTableMaxSize; i++)
-    {
-      hashTable[i].locs = NULL;
-    }
-
-  //Loading Fasta File
   if (!initLoadingRefGenome(fileName))
-    return;		
+    return;
   initSavingIHashTable(indexName);
-	
+
   fprintf(stderr, "Generating Index from %s", fileName);
   fflush(stderr);
 
@@ -236,7 +2794,10 @@ void generateIHashTable(char *fileName, char *indexName)
 
   do
     {
-      flag = 	 loadRefGenome (&refGen, &refGenName, &refGenOff);	
+      flag = loadRefGenome (&refGen, &refGenName, &refGenOff);
+
+      if (indexAppendMode && isIHashTableChunkIndexed(refGenName))
+	continue;
 
       if ( strcmp(prev, refGenName) != 0)
 	{
@@ -249,155 +2810,204 @@ void generateIHashTable(char *fileName, char *indexName)
 	  fprintf(stderr, ".");
 	  fflush(stderr);
 	}
-		
-      l = strlen(refGen) - WINDOW_SIZE;
-
-      for (i=0; i < l; i++)
-	{
-	  hv = hashVal(refGen + i);
-	  if (hv != -1)
-	    {
-	      hashTableSize += addIHashTableLocation (hashTable, hv, i+1);
-	    }
-	}
 
-      saveIHashTable(hashTable, hashTableSize, hashTableMaxSize, refGen, refGenName, refGenOff);
-      freeIHashTableContent(hashTable, hashTableMaxSize);
-      hashTableSize = 0;
+      saveFMIndex(refGen, refGenName, refGenOff);
     } while (flag);
 
   freeMem(prev, CONTIG_NAME_SIZE);
-  freeMem(hashTable, sizeof(IHashTable)*hashTableMaxSize);
-
   finalizeLoadingRefGenome();
   finalizeSavingIHashTable();
 
   fprintf(stderr, "\nDONE in %0.2fs!\n", (getTime()-startTime));
 }
-
 /**********************************************/
-void finalizeLoadingIHashTable()
+void finalizeLoadingFMIndex()
 {
-  freeIHashTableContent(_ih_hashTable, _ih_maxHashTableSize);
-  freeMem(_ih_hashTable, sizeof(IHashTable)* _ih_maxHashTableSize);
-  freeMem(_ih_refGen, strlen(_ih_refGen)+1) ;
-  freeMem(_ih_refGenName, strlen(_ih_refGenName)+1);
-  fclose(_ih_fp);
-}
+  int i;
 
+  for (i=0; i<FM_BUFFER_CNT; i++)
+    if (_fm_buf[i] != NULL)
+      {
+	freeMem(_fm_buf[i], sizeof(unsigned int) * _fm_bufSize[i]);
+	_fm_buf[i] = NULL;
+	_fm_bufSize[i] = 0;
+      }
+  finalizeLoadingKHashTable();
+}
 /**********************************************/
-int  loadIHashTable(double *loadTime)
+int loadFMIndex(double *loadTime)
 {
   double startTime = getTime();
-  unsigned char extraInfo = 0;
-  short len;
-  unsigned int refGenLength;
-  unsigned int hashTableSize;
-  unsigned int tmpSize;
-  int tmp;
-  int i=0,j=0;
+  IndexChunk *chunk;
+  IHashTableSlot *slot;
+  int next = nextIHashTableChunk();
 
-  if ( fread(&extraInfo, sizeof(extraInfo), 1, _ih_fp) != sizeof(extraInfo) )
+  if (next < 0)
     return 0;
 
-  freeIHashTableContent(_ih_hashTable, _ih_maxHashTableSize);
-  freeMem(_ih_refGen, strlen(_ih_refGen)+1) ;
-  freeMem(_ih_refGenName, strlen(_ih_refGenName)+1);
-
-  // Reading Chr Name
-  tmp = fread(&len, sizeof(len), 1, _ih_fp);
-  if (tmp == 0){
-    fprintf(stderr, "Read error while loading hash table.\n");
-    exit(0);
-  }
+  slot = useIHashTableSlot(next);
+  _ih_curChunk = next;
+  chunk = &_ih_chunks[_ih_curChunk];
 
-  _ih_refGenName = getMem(sizeof(char)* (len+1));
-  tmp = fread(_ih_refGenName, sizeof(char), len, _ih_fp);
-  _ih_refGenName [len] ='\0';
+  _ih_refGenOff = chunk->refGenOffset;
 
-  tmp = fread(&_ih_refGenOff, sizeof (_ih_refGenOff), 1, _ih_fp);
+  _fm_n = chunk->locCnt;
+  _fm_C = (unsigned int *)(slot->base + chunk->refBytes);
+  _fm_blocks = (FMBlock *)(_fm_C + 4);
+  _fm_samples = (unsigned int *)(_fm_blocks + _fm_n/64 + 1);
 
-  // Reading Size and Content of Ref Genome
-  tmp = fread(&refGenLength, sizeof(refGenLength), 1, _ih_fp);
-  _ih_refGen = getMem(sizeof(char)*(refGenLength+1));
-  tmp = fread(_ih_refGen, sizeof(char), refGenLength, _ih_fp);
-  _ih_refGen[refGenLength]='\0';
+  startIHashTablePrefetch();
+  *loadTime = getTime()-startTime;
+  return 1;
+}
+/**********************************************/
+// Occurrences of c in the BWT rows before i
+static inline unsigned int occFMIndex(unsigned int c, unsigned int i)
+{
+  FMBlock *b = &_fm_blocks[i >> 6];
+  unsigned long long m = ((c & 1) ? b->lo : ~b->lo) & ((c & 2) ? b->hi : ~b->hi) & ~b->other;
 
-  //Reading Hashtable Size and Content
-  tmp = fread(&hashTableSize, sizeof(hashTableSize), 1, _ih_fp);
-	
-  unsigned int hv;
-  unsigned char cnt=0;
-  //unsigned int  index = 1;
-  //unsigned int  tmpValue = 0;
+  return b->occ[c] + __builtin_popcountll(m & ((1ULL << (i & 63)) - 1));
+}
+/**********************************************/
+// Narrows [lo, hi) to the rows of the suffixes starting with c
+static inline void extendFMIndex(unsigned int c, unsigned int *lo, unsigned int *hi)
+{
+  *lo = _fm_C[c] + occFMIndex(c, *lo);
+  *hi = _fm_C[c] + occFMIndex(c, *hi);
+}
+/**********************************************/
+// Text position of row i, walking back to the closest sampled row
+unsigned int locateFMIndex(unsigned int i)
+{
+  unsigned int steps = 0, c, r;
+  FMBlock *b;
 
-  for (i=0; i<hashTableSize; i++)
+  while (1)
     {
-      //index = 1;
-      tmp = fread(&hv, sizeof(hv), 1, _ih_fp);
-      tmp = fread(&cnt, sizeof(cnt), 1, _ih_fp);
+      b = &_fm_blocks[i >> 6];
+      r = i & 63;
+      if ((b->smp >> r) & 1)
+	return _fm_samples[b->sampled + __builtin_popcountll(b->smp & ((1ULL << r) - 1))] + steps;
+      c = ((b->lo >> r) & 1) | (((b->hi >> r) & 1) << 1);
+      i = _fm_C[c] + occFMIndex(c, i);
+      steps++;
+    }
+}
+/**********************************************/
+// Sorted [count, loc1..locN] of the rows [lo, hi), each moved by shift
+unsigned int *locateFMIndexRange(unsigned int lo, unsigned int hi, unsigned int shift)
+{
+  unsigned int i, cnt = hi - lo;
+  int k = _fm_bufNext;
 
-      if (cnt>0)
-	{
-	  tmpSize = cnt;
-	}
-      else
-	{
-	  tmp = fread(&tmpSize, sizeof(tmpSize), 1, _ih_fp);
-	}
-		
-      _ih_hashTable[hv].locs = getMem( sizeof(unsigned int)* (tmpSize+1) );
-      _ih_hashTable[hv].locs[0] = tmpSize;
+  _fm_bufNext = (_fm_bufNext + 1) % FM_BUFFER_CNT;
+  if (cnt + 1 > _fm_bufSize[k])
+    {
+      if (_fm_buf[k] != NULL)
+	freeMem(_fm_buf[k], sizeof(unsigned int) * _fm_bufSize[k]);
+      _fm_bufSize[k] = (cnt + 1 > 64) ? cnt + 1 : 64;
+      _fm_buf[k] = getMem(sizeof(unsigned int) * _fm_bufSize[k]);
+    }
 
-		
-      for (j=1; j<=tmpSize; j++) 
-	tmp = fread(&(_ih_hashTable[hv].locs[j]), sizeof(_ih_hashTable[hv].locs[j]), 1, _ih_fp);
-		
-      /*
+  _fm_buf[k][0] = cnt;
+  for (i=0; i<cnt; i++)
+    _fm_buf[k][i+1] = locateFMIndex(lo + i) + shift + 1;
+  qsort(_fm_buf[k] + 1, cnt, sizeof(unsigned int), compareLocation);
+  return _fm_buf[k];
+}
+/**********************************************/
+unsigned int *getFMIndexCandidates(long long hv)
+{
+  unsigned int lo = 0, hi = _fm_n;
+  int k;
 
-	if(tmpSize != 0)
-	{
-	tmp = fread(&(_ih_hashTable[hv].locs[index]), sizeof(_ih_hashTable[hv].locs[index]), 1, _ih_fp);
-	index++;
-	}
+  if (hv == -1)
+    return NULL;
 
-	for (j=2; j<=tmpSize; j++)	
-	{
-	tmp = fread(&tmpValue, sizeof(_ih_hashTable[hv].locs[index-1]), 1, _ih_fp);
-	if(abs(tmpValue-_ih_hashTable[hv].locs[index-1]) >  errThreshould)
-	{
-	_ih_hashTable[hv].locs[index] = tmpValue;
-	index++;
-	}
-	}
-	_ih_hashTable[hv].locs[0] = index-1;
-		
-      */
-    }
+  for (k=0; k<WINDOW_SIZE && lo < hi; k++)
+    extendFMIndex((hv >> (2*k)) & 3, &lo, &hi);
 
-  *loadTime = getTime()-startTime;
-  return 1;
+  if (lo >= hi)
+    return NULL;
+  return locateFMIndexRange(lo, hi, 0);
 }
 /**********************************************/
-unsigned int *getIHashTableCandidates(int hv)
+// Candidates of the window at seq. While it has more than maxCount
+// locations it is extended to the left, by at most left bases. Returns NULL
+// with count set to the locations of the window if that does not help.
+unsigned int *getFMIndexSeedCandidates(char *seq, int left, unsigned int maxCount, unsigned int *count)
 {
-  if ( hv != -1 )
-    return _ih_hashTable[hv].locs;
-  else 
+  unsigned int lo = 0, hi = _fm_n, plo, phi;
+  int k, c, ext = 0;
+
+  *count = 0;
+  for (k=WINDOW_SIZE-1; k>=0; k--)
+    {
+      c = _ih_code[(unsigned char)seq[k]];
+      if (c < 0)
+	return NULL;
+      extendFMIndex(c, &lo, &hi);
+      if (lo >= hi)
+	return NULL;
+    }
+  *count = hi - lo;
+
+  while (maxCount > 0 && hi - lo > maxCount && ext < left)
+    {
+      c = _ih_code[(unsigned char)seq[-ext-1]];
+      if (c < 0)
+	break;
+      plo = lo;
+      phi = hi;
+      extendFMIndex(c, &plo, &phi);
+      if (plo >= phi)
+	break;
+      lo = plo;
+      hi = phi;
+      ext++;
+    }
+
+  if (maxCount > 0 && hi - lo > maxCount)
     return NULL;
+  return locateFMIndexRange(lo, hi, ext);
 }
 /**********************************************/
 /**********************************************/
 /**********************************************/
 void configHashTable()
 {
-  if (WINDOW_SIZE <= 15)
+  if (!IH_KEYS64)
     {
       generateHashTable = &generateIHashTable;
       loadHashTable = &loadIHashTable;
       finalizeLoadingHashTable = &finalizeLoadingIHashTable;
       getCandidates = &getIHashTableCandidates;
     }
+  else
+    {
+      generateHashTable = &generateKHashTable;
+      loadHashTable = &loadKHashTable;
+      finalizeLoadingHashTable = &finalizeLoadingKHashTable;
+      getCandidates = &getKHashTableCandidates;
+    }
+
+  getSeedCandidates = NULL;
+
+  if (indexMemory > 0)
+    generateHashTable = &generateEHashTable;
+
+  if (windowSizeCnt > 1)
+    generateHashTable = &generateMultiHashTable;
+
+  if (indexFM)
+    {
+      generateHashTable = &generateFMIndex;
+      loadHashTable = &loadFMIndex;
+      finalizeLoadingHashTable = &finalizeLoadingFMIndex;
+      getCandidates = &getFMIndexCandidates;
+      getSeedCandidates = &getFMIndexSeedCandidates;
+    }
 }
 /**********************************************/
 int initLoadingHashTable(char *fileName)
@@ -406,11 +3016,28 @@ int initLoadingHashTable(char *fileName)
   unsigned char bsIndex;
   int tmp; 
 
+  // A job of --serve may only search the index the server keeps
+  if (_ih_residentMap != NULL)
+    {
+      char path[PATH_MAX];
+      if (realpath(fileName, path) == NULL || strcmp(path, _ih_residentPath) != 0)
+	{
+	  fprintf(stderr, "Error: The job searches %s, but the server keeps %s.\n", fileName, _ih_residentPath);
+	  return 0;
+	}
+    }
+
   _ih_fp = fileOpen(fileName, "r");	
 
   if (_ih_fp == NULL)
     return 0;
 
+  if (contigRegex != NULL && regcomp(&_ih_contigRegex, contigRegex, REG_EXTENDED | REG_NOSUB) != 0)
+    {
+      fprintf(stderr, "Error: Invalid contig regular expression %s\n", contigRegex);
+      return 0;
+    }
+
   tmp = fread(&bsIndex, sizeof(bsIndex), 1, _ih_fp);
 
   if (tmp == 0){
@@ -418,7 +3045,7 @@ int initLoadingHashTable(char *fileName)
     exit(0);
   }
 
-  if (bsIndex)
+  if (bsIndex && bsIndex != INDEX_TYPE_FLAT)
     {
       fprintf(stderr, "Error: Wrong Type of Index indicated");
       return 0;
@@ -426,41 +3053,165 @@ int initLoadingHashTable(char *fileName)
 	
   tmp = fread(&WINDOW_SIZE, sizeof(WINDOW_SIZE), 1, _ih_fp);
 
+  if (bsIndex == INDEX_TYPE_FLAT)
+    {
+      IndexHeader header;
+      fseeko(_ih_fp, 0, SEEK_SET);
+      tmp = fread(&header, sizeof(header), 1, _ih_fp);
+      // The file may have been rebuilt since; the resident map is what is searched
+      if (_ih_residentMap != NULL)
+	memcpy(&header, _ih_residentMap, sizeof(header));
+      WINDOW_SIZE = header.windowSize;
+      indexFM = (header.flags & INDEX_FLAG_FM) ? 1 : 0;
+      indexMinimizer = (header.flags & INDEX_FLAG_MINIMIZER) ? header.minimizerWindow : 0;
+      seedCnt = (header.flags & INDEX_FLAG_SPACED) ? header.seedCnt : 0;
+      memcpy(seedMask, header.seedMask, sizeof(seedMask));
+    }
+  else
+    seedCnt = indexMinimizer = 0;
+
   configHashTable();
 
+  if (IH_KEYS64 || indexFM)
+    {
+      if (bsIndex != INDEX_TYPE_FLAT)
+	{
+	  fprintf(stderr, "Error: Wrong Type of Index indicated");
+	  return 0;
+	}
+      return initLoadingFlatIHashTable();
+    }
+
   if (_ih_maxHashTableSize != pow(4, WINDOW_SIZE))
     {
 
       if (_ih_hashTable != NULL)
 	{
 	  freeIHashTableContent(_ih_hashTable, _ih_maxHashTableSize);
-	  freeMem(_ih_hashTable, sizeof(IHashTable)* _ih_maxHashTableSize);
-	  freeMem(_ih_refGen, strlen(_ih_refGen)+1) ;
+	  freeLargeMem(_ih_hashTable, sizeof(IHashTable)* _ih_maxHashTableSize);
+	  freeLargeMem(_ih_refGen, strlen(_ih_refGen)+1) ;
 	  freeMem(_ih_refGenName, strlen(_ih_refGenName)+1);
 	}
 
       _ih_maxHashTableSize = pow(4, WINDOW_SIZE);
 
-      _ih_hashTable = getMem (sizeof(IHashTable) * _ih_maxHashTableSize);
+      _ih_hashTable = getLargeMem(sizeof(IHashTable) * _ih_maxHashTableSize);
       for (i=0; i<_ih_maxHashTableSize; i++)
 	_ih_hashTable[i].locs = NULL;
-      _ih_refGen = getMem(1);
+      _ih_refGen = getLargeMem(1);
       _ih_refGen[0]='\0';
       _ih_refGenName = getMem(1);
       _ih_refGenName[0] = '\0';
     }
 
+  if (bsIndex == INDEX_TYPE_FLAT)
+    return initLoadingFlatIHashTable();
+
+  return 1;
+}
+/**********************************************/
+// Maps the index and prepares all of its chunks once for --serve. The
+// searches forked for its jobs find them in place instead of loading and
+// decoding them again.
+int initServingHashTable(char *fileName)
+{
+  int i;
+
+  if (!initLoadingHashTable(fileName) || realpath(fileName, _ih_residentPath) == NULL)
+    return 0;
+
+  if (_ih_map == NULL)
+    {
+      fprintf(stderr, "Error: --serve needs an index built by this version of mrFAST.\n");
+      return 0;
+    }
+
+  _ih_residentSlots = getMem(sizeof(IHashTableSlot) * _ih_chunkCnt);
+  memset(_ih_residentSlots, 0, sizeof(IHashTableSlot) * _ih_chunkCnt);
+  for (i=0; i<_ih_chunkCnt; i++)
+    {
+      reserveIHashTableSlot(&_ih_residentSlots[i], i);
+      fillIHashTableSlot(&_ih_residentSlots[i]);
+    }
+
+  _ih_residentMap = _ih_map;
+  _ih_residentMapSize = _ih_mapSize;
+  fclose(_ih_fp);
+  _ih_fp = NULL;
+  return 1;
+}
+/**********************************************/
+// Output side of --index-patch while the reference index is being loaded
+IHashTableOutput	_ih_patchOutput;
+
+// Loads the reference index with its settings and opens patchName for the
+// patched index. The prefetch thread is turned off: it would read the chunk
+// table of the patched index while its chunks are saved.
+int initPatchingHashTable(char *fileName, char *patchName)
+{
+  if (!initAppendingHashTable(fileName))
+    return 0;
+
+  if (indexFM || indexMinimizer)
+    {
+      fprintf(stderr, "Error: FM-indexes and minimizer indexes cannot be patched.\n");
+      return 0;
+    }
+
+  indexPrefetch = 0;
+  if (!initLoadingHashTable(fileName))
+    return 0;
+
+  memset(&_ih_patchOutput, 0, sizeof(_ih_patchOutput));
+  swapIHashTableOutput(&_ih_patchOutput);
+  initSavingIHashTable(patchName);
+  swapIHashTableOutput(&_ih_patchOutput);
   return 1;
 }
 /**********************************************/
+// Saves a patched chunk from its (key, location) pairs sorted by key, then
+// by location
+void savePatchedHashTable(unsigned long long *keys, unsigned int *locs, unsigned int n, char *refGen, char *refGenName, int refGenOffset)
+{
+  unsigned int hashTableMaxSize, *bucketStart, i, j;
+
+  swapIHashTableOutput(&_ih_patchOutput);
+  if (IH_KEYS64)
+    saveKHashTable(keys, locs, n, refGen, refGenName, refGenOffset);
+  else
+    {
+      hashTableMaxSize = pow(4, WINDOW_SIZE);
+      bucketStart = getMem(sizeof(unsigned int) * (hashTableMaxSize+2));
+      for (i=0, j=0; i <= hashTableMaxSize; i++)
+	{
+	  for (; j < n && keys[j] < i; j++);
+	  bucketStart[i] = j;
+	}
+      saveIHashTable(bucketStart, locs, hashTableMaxSize, refGen, refGenName, refGenOffset);
+      freeMem(bucketStart, sizeof(unsigned int) * (hashTableMaxSize+2));
+    }
+  swapIHashTableOutput(&_ih_patchOutput);
+}
+/**********************************************/
+void finalizePatchingHashTable()
+{
+  finalizeLoadingHashTable();
+  swapIHashTableOutput(&_ih_patchOutput);
+  finalizeSavingIHashTable();
+}
+/**********************************************/
 char *getRefGenome()
 {
+  if (_ih_map != NULL && _ih_curChunk >= 0)
+    return _ih_curRef;
   return _ih_refGen;
 
 }
 /**********************************************/
 char *getRefGenomeName()
 {
+  if (_ih_map != NULL && _ih_curChunk >= 0)
+    return _ih_chunks[_ih_curChunk].name;
   return _ih_refGenName;
 
 }
@@ -475,3 +3226,74 @@ HashTable *getHashTable()
 {
   return NULL;
 }
+/**********************************************/
+// Chunk entry of the loaded chunk; NULL for chunk stream indexes
+IndexChunk *getIndexChunk()
+{
+  if (_ih_map != NULL && _ih_curChunk >= 0)
+    return &_ih_chunks[_ih_curChunk];
+  return NULL;
+}
+/**********************************************/
+// Keys of the loaded chunk, overflow keys included. Chunk stream indexes
+// enumerate every possible key; FM-indexes have none.
+unsigned int getIndexKeyCount()
+{
+  if (_ih_map == NULL)
+    return _ih_maxHashTableSize;
+  if (indexFM || _ih_curChunk < 0)
+    return 0;
+  return _ih_chunks[_ih_curChunk].keyCnt + _ih_ovKeyCnt;
+}
+/**********************************************/
+// [count, locs] of the k-th key of the loaded chunk, NULL if it is empty
+unsigned int *getIndexKey(unsigned int k, unsigned long long *key)
+{
+  unsigned int keyCnt;
+
+  if (_ih_map == NULL)
+    {
+      *key = k;
+      return _ih_hashTable[k].locs;
+    }
+
+  keyCnt = _ih_chunks[_ih_curChunk].keyCnt;
+  if (k >= keyCnt)
+    {
+      *key = _ih_ovKeys[k - keyCnt];
+      return _ih_ovLocs + _ih_ovStarts[k - keyCnt];
+    }
+  if (IH_KEYS64)
+    {
+      *key = _ih_curKeys64[k];
+      return _ih_curLocs + _ih_curStarts[k];
+    }
+  *key = _ih_curKeys[k];
+  return _ih_hashTable[*key].locs;
+}
+/**********************************************/
+// Bases of a key; positions outside the spaced seed mask are shown as -
+void decodeHashVal(unsigned long long key, char *seq)
+{
+  int i, seed = 0, shift = 2*WINDOW_SIZE;
+  unsigned int mask = (1U << WINDOW_SIZE) - 1;
+
+  if (seedCnt)
+    {
+      shift = 2*__builtin_popcount(seedMask[0]);
+      seed = key >> shift;
+      mask = seedMask[seed];
+    }
+
+  for (i=0; i<WINDOW_SIZE; i++)
+    {
+      if (!(mask & (1U << i)))
+	{
+	  seq[i] = '-';
+	  continue;
+	}
+      shift -= 2;
+      seq[i] = "ACGT"[(key >> shift) & 3];
+    }
+  seq[WINDOW_SIZE] = '\0';
+}
@@ -57,17 +57,91 @@ typedef struct
 	unsigned int *locs;
 } IHashTable;
 
-int				hashVal(char *seq);
+#define INDEX_TYPE_FLAT		2		// First byte of a flat index; chunk stream indexes start with 0
+#define INDEX_FLAG_COMPRESSED	1		// Location lists are delta + group varint coded
+#define INDEX_FLAG_PACKED_REF	2		// Reference is stored with 2 bits per base
+#define INDEX_FLAG_FM		4		// Chunks hold an FM-index instead of keys
+#define INDEX_FLAG_MINIMIZER	8		// Only the minimizers of every minimizerWindow keys are stored
+#define INDEX_MAX_MINIMIZER	64		// Largest minimizer window
+#define INDEX_FLAG_SPACED	16		// Keys are taken through the seedMask of the header
+#define INDEX_FM_SAMPLE		16		// Suffix array sampling of the FM-index
+
+// Flat index: header, chunks, chunk table. Every chunk holds refBytes of
+// reference ('\0' terminated, padded to 8 bytes), the sorted keys, the start of each
+// key in the location area, and the location area itself where each key
+// owns [count, loc1, ..., locN]. Compressed indexes replace the keys, the
+// starts and the location area with locBytes of group varint streams: the
+// keys, the running location counts and the locations of every key.
+// A packed reference holds 4 bases per byte followed by the count and the
+// list of runs of other characters (IndexRefRun).
+// Keys with more than maxFreq locations are stored uncompressed in the
+// overflow area of the chunk: 64-bit keys, starts and [count, locs] lists.
+// FM-index chunks hold C[4], the BWT blocks and keyCnt suffix array samples
+// behind the reference; locCnt is the number of BWT rows.
+// Minimizer and spaced seed indexes use the 64-bit key layout for every
+// window size. A spaced seed key holds the bases under the mask, and the
+// mask number above them when there are several masks.
+typedef struct
+{
+	unsigned char		type;
+	unsigned char		windowSize;
+	unsigned short		flags;
+	unsigned int		chunkCnt;
+	unsigned long long	chunkTableOffset;
+	unsigned int		maxFreq;
+	unsigned int		minimizerWindow;
+	unsigned int		seedCnt;
+	unsigned int		seedMask[MAX_SEED_MASKS];
+	unsigned int		reserved[5];
+} IndexHeader;
+
+typedef struct
+{
+	char			name[CONTIG_NAME_SIZE];
+	int			refGenOffset;
+	unsigned int		refGenLength;
+	unsigned int		keyCnt;
+	unsigned int		locCnt;
+	unsigned long long	offset;
+	unsigned long long	locBytes;
+	unsigned long long	refBytes;
+	unsigned long long	overflowOffset;
+	unsigned int		overflowKeyCnt;
+	unsigned int		overflowLocCnt;
+} IndexChunk;
+
+typedef struct
+{
+	unsigned int		pos;
+	unsigned int		len;
+	unsigned int		ch;
+} IndexRefRun;
+
+long long			hashVal(char *seq);
+long long			hashSeedVal(char *seq, int window);
+int				getSeedOffsets(char *seq, int length, int *offsets);
+unsigned int		*getOverflowCandidates(long long hv);
 void			configHashTable();
 char			*getRefGenome();
 char			*getRefGenomeName();
 int				getRefGenomeOffset();
 int				initLoadingHashTable(char *fileName);
+int				initServingHashTable(char *fileName);
+int				initAppendingHashTable(char *fileName);
+int				initPatchingHashTable(char *fileName, char *patchName);
+void			savePatchedHashTable(unsigned long long *keys, unsigned int *locs, unsigned int n, char *refGen, char *refGenName, int refGenOffset);
+void			finalizePatchingHashTable();
+void			sortKHashTablePairs(unsigned long long *keys, unsigned int *locs, unsigned long long *tmpKeys, unsigned int *tmpLocs, unsigned int n);
 HashTable		*getHashTable();
+IndexChunk		*getIndexChunk();
+unsigned int		getIndexKeyCount();
+unsigned int		*getIndexKey(unsigned int k, unsigned long long *key);
+void			decodeHashVal(unsigned long long key, char *seq);
 
 void 			(*generateHashTable)(char *fileName, char *indexName);
 int				(*loadHashTable)(double *loadTime);
 void			(*finalizeLoadingHashTable)();
-unsigned int	*(*getCandidates)(int hv);
+unsigned int	*(*getCandidates)(long long hv);
+unsigned int	*(*getSeedCandidates)(char *seq, int left, unsigned int maxCount, unsigned int *count);
 
 #endif
@@ -0,0 +1,584 @@
+/*
+ * Copyright (c) <2008 - 2020>, University of Washington, Simon Fraser University, 
+ * Bilkent University and Carnegie Mellon University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice, this
+ *   list of conditions and the following disclaimer in the documentation and/or other
+ *   materials provided with the distribution.
+ * - Neither the names of the University of Washington, Simon Fraser University, 
+ *   Bilkent University, Carnegie Mellon University,
+ *   nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+  Authors: 
+  Farhad Hormozdiari
+	  farhadh AT uw DOT edu
+  Faraz Hach
+	  fhach AT cs DOT sfu DOT ca
+  Can Alkan
+	  calkan AT gmail DOT com
+  Hongyi Xin
+	  gohongyi AT gmail DOT com
+  Donghyuk Lee
+	  bleups AT gmail DOT com
+*/
+
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <zlib.h>
+#include "Common.h"
+#include "HashTable.h"
+#include "IndexPatch.h"
+
+#define IP_LINE_SIZE		65536			// First columns of a VCF line
+#define IP_BLOCK_BITS		8			// 2^IP_BLOCK_BITS positions per block of the coordinate map
+
+// Variant of the VCF: REF and ALT are kept in _ip_seqs
+typedef struct
+{
+  unsigned int		pos;			// 0-based start of REF in the contig
+  unsigned int		refLen;
+  unsigned int		altLen;
+  unsigned long long	ref;
+  unsigned long long	alt;
+} IndexPatchVariant;
+
+typedef struct
+{
+  char			name[CONTIG_NAME_SIZE];
+  unsigned int		first;			// Variants of the contig: [first, end)
+  unsigned int		end;
+} IndexPatchContig;
+
+// Edit of the loaded chunk: refLen bases at pos become the altLen bases of
+// alt, which start at newPos in the patched chunk
+typedef struct
+{
+  unsigned int		pos;
+  unsigned int		refLen;
+  unsigned int		altLen;
+  unsigned int		newPos;
+  char			*alt;
+} IndexPatchEdit;
+
+IndexPatchVariant	*_ip_vars		= NULL;
+size_t			_ip_varCnt		= 0;
+size_t			_ip_varBytes		= 0;
+char			*_ip_seqs		= NULL;
+size_t			_ip_seqSize		= 0;
+size_t			_ip_seqBytes		= 0;
+IndexPatchContig	*_ip_contigs		= NULL;
+size_t			_ip_contigCnt		= 0;
+size_t			_ip_contigBytes		= 0;
+unsigned int		_ip_cursor		= 0;	// Next variant of the contig being patched
+unsigned int		_ip_cursorEnd		= 0;
+
+IndexPatchEdit		*_ip_edits		= NULL;	// Edits of the loaded chunk
+size_t			_ip_editBytes		= 0;
+unsigned int		_ip_editCnt		= 0;
+unsigned int		*_ip_firstEdit		= NULL;	// First edit ending after each block
+int			*_ip_shift		= NULL;	// Length change of the edits before it
+size_t			_ip_blockBytes		= 0;
+char			*_ip_ref		= NULL;	// Patched reference of the chunk
+size_t			_ip_refBytes		= 0;
+char			*_ip_tail		= NULL;	// Patched overlap of the previous chunk
+int			_ip_newOffset		= 0;	// Patched offset and length of the previous chunk
+unsigned int		_ip_newLength		= 0;
+
+unsigned long long	*_ip_keys		= NULL;	// (key, location) pairs of the patched chunk
+unsigned int		*_ip_locs		= NULL;
+size_t			_ip_pairCnt		= 0;
+unsigned long long	*_ip_newKeys		= NULL;	// Pairs of the windows over the edits
+unsigned int		*_ip_newLocs		= NULL;
+unsigned long long	*_ip_tmpKeys		= NULL;
+unsigned int		*_ip_tmpLocs		= NULL;
+size_t			_ip_newPairCnt		= 0;
+
+unsigned int		_ip_applied		= 0;
+unsigned int		_ip_skipped		= 0;	// Symbolic and overlapping variants
+unsigned int		_ip_mismatched		= 0;	// REF differs from the reference
+unsigned int		_ip_crossing		= 0;	// REF runs into the next chunk
+/**********************************************/
+// Grows a buffer of *bytes bytes to hold need bytes, keeping the first used
+void *growIndexPatchBuffer(void *buf, size_t used, size_t *bytes, size_t need)
+{
+  size_t newBytes = (*bytes == 0) ? 4096 : *bytes;
+  void *tmp;
+
+  if (need <= *bytes)
+    return buf;
+  while (newBytes < need)
+    newBytes *= 2;
+
+  tmp = getMem(newBytes);
+  if (buf != NULL)
+    {
+      memcpy(tmp, buf, used);
+      freeMem(buf, *bytes);
+    }
+  *bytes = newBytes;
+  return tmp;
+}
+/**********************************************/
+unsigned long long addIndexPatchSeq(char *seq, unsigned int len)
+{
+  unsigned long long start = _ip_seqSize;
+  unsigned int i;
+
+  _ip_seqs = growIndexPatchBuffer(_ip_seqs, _ip_seqSize, &_ip_seqBytes, _ip_seqSize + len);
+  for (i=0; i<len; i++)
+    _ip_seqs[_ip_seqSize++] = toupper(seq[i]);
+  return start;
+}
+/**********************************************/
+int findIndexPatchContig(char *name)
+{
+  int i;
+
+  for (i=0; i<_ip_contigCnt; i++)
+    if (strcmp(_ip_contigs[i].name, name) == 0)
+      return i;
+  return -1;
+}
+/**********************************************/
+// Reads the first ALT allele of every record of a normalized VCF (plain or
+// gzipped), sorted by position within each contig. Symbolic alleles and
+// records overlapping the previous one are skipped, as bcftools consensus does.
+int loadIndexPatchVariants(char *vcfFile)
+{
+  gzFile fp = fileOpenGZ(vcfFile, "r");
+  char *line = getMem(IP_LINE_SIZE);
+  char skip[4096];
+  char *chrom, *pos, *ref, *alt;
+  long long start, prevEnd = 0;
+  IndexPatchVariant *v;
+  IndexPatchContig *c;
+  size_t len;
+
+  while (gzgets(fp, line, IP_LINE_SIZE) != NULL)
+    {
+      // Only the first columns are needed; the samples of a long line are dropped
+      len = strlen(line);
+      if (len > 0 && line[len-1] != '\n')
+	while (gzgets(fp, skip, sizeof(skip)) != NULL && skip[strlen(skip)-1] != '\n');
+
+      if (line[0] == '#' || line[0] == '\n')
+	continue;
+
+      chrom = strtok(line, "\t");
+      pos = strtok(NULL, "\t");
+      ref = (strtok(NULL, "\t") != NULL) ? strtok(NULL, "\t") : NULL;
+      alt = strtok(NULL, "\t\n");
+      if (alt == NULL)
+	{
+	  fprintf(stderr, "Error: Malformed VCF record in %s\n", vcfFile);
+	  return 0;
+	}
+      alt[strcspn(alt, ",")] = '\0';
+
+      if (_ip_contigCnt == 0 || strcmp(_ip_contigs[_ip_contigCnt-1].name, chrom) != 0)
+	{
+	  if (findIndexPatchContig(chrom) >= 0)
+	    {
+	      fprintf(stderr, "Error: The records of %s are not together in %s\n", chrom, vcfFile);
+	      return 0;
+	    }
+	  _ip_contigs = growIndexPatchBuffer(_ip_contigs, sizeof(IndexPatchContig) * _ip_contigCnt, &_ip_contigBytes,
+					     sizeof(IndexPatchContig) * (_ip_contigCnt + 1));
+	  c = &_ip_contigs[_ip_contigCnt++];
+	  snprintf(c->name, CONTIG_NAME_SIZE, "%s", chrom);
+	  c->first = c->end = _ip_varCnt;
+	  prevEnd = 0;
+	}
+
+      start = atoll(pos) - 1;
+      if (start < prevEnd || alt[0] == '<' || alt[0] == '*' || alt[0] == '.' || strpbrk(alt, "[]") != NULL)
+	{
+	  _ip_skipped++;
+	  continue;
+	}
+      if (strcasecmp(ref, alt) == 0)
+	continue;
+
+      _ip_vars = growIndexPatchBuffer(_ip_vars, sizeof(IndexPatchVariant) * _ip_varCnt, &_ip_varBytes,
+				      sizeof(IndexPatchVariant) * (_ip_varCnt + 1));
+      v = &_ip_vars[_ip_varCnt++];
+      v->pos = start;
+      v->refLen = strlen(ref);
+      v->altLen = strlen(alt);
+      v->ref = addIndexPatchSeq(ref, v->refLen);
+      v->alt = addIndexPatchSeq(alt, v->altLen);
+      _ip_contigs[_ip_contigCnt-1].end = _ip_varCnt;
+      prevEnd = start + v->refLen;
+    }
+
+  freeMem(line, IP_LINE_SIZE);
+  gzclose(fp);
+  return 1;
+}
+/**********************************************/
+void addIndexPatchEdit(unsigned int pos, unsigned int refLen, char *alt, unsigned int altLen)
+{
+  IndexPatchEdit *e;
+
+  _ip_edits = growIndexPatchBuffer(_ip_edits, sizeof(IndexPatchEdit) * _ip_editCnt, &_ip_editBytes,
+				   sizeof(IndexPatchEdit) * (_ip_editCnt + 1));
+  e = &_ip_edits[_ip_editCnt++];
+  e->pos = pos;
+  e->refLen = refLen;
+  e->alt = alt;
+  e->altLen = altLen;
+}
+/**********************************************/
+// Edits of the loaded chunk in chunk coordinates. A chunk after the first one
+// of its contig starts with the overlap of the previous chunk: it is replaced
+// by the patched overlap, and the variants are taken from behind it.
+void collectIndexPatchEdits(char *ref, unsigned int len, int offset)
+{
+  IndexPatchVariant *v;
+  unsigned int from = 0;
+
+  _ip_editCnt = 0;
+  if (offset > 0)
+    {
+      from = CONTIG_OVERLAP;
+      if (strncmp(ref, _ip_tail, CONTIG_OVERLAP) != 0)
+	addIndexPatchEdit(0, CONTIG_OVERLAP, _ip_tail, CONTIG_OVERLAP);
+    }
+
+  for (; _ip_cursor < _ip_cursorEnd; _ip_cursor++)
+    {
+      v = &_ip_vars[_ip_cursor];
+      if (v->pos >= offset + len)
+	break;
+      if (v->pos < offset + from)
+	continue;
+      if (v->pos + v->refLen > offset + len)
+	{
+	  _ip_crossing++;
+	  continue;
+	}
+      if (strncmp(ref + v->pos - offset, _ip_seqs + v->ref, v->refLen) != 0)
+	{
+	  _ip_mismatched++;
+	  continue;
+	}
+      addIndexPatchEdit(v->pos - offset, v->refLen, _ip_seqs + v->alt, v->altLen);
+      _ip_applied++;
+    }
+}
+/**********************************************/
+// Writes the patched chunk to _ip_ref and builds the coordinate map: for
+// every block the first edit that ends after its start and the length change
+// of the edits before that one.
+unsigned int applyIndexPatchEdits(char *ref, unsigned int len)
+{
+  unsigned int blockCnt = (len >> IP_BLOCK_BITS) + 1;
+  unsigned int i, b, pos = 0, newLen = 0;
+  int shift = 0;
+  IndexPatchEdit *e;
+
+  for (i=0; i<_ip_editCnt; i++)
+    newLen += _ip_edits[i].altLen - _ip_edits[i].refLen;
+  newLen += len;
+
+  _ip_ref = growIndexPatchBuffer(_ip_ref, 0, &_ip_refBytes, newLen + 1);
+  for (i=0, newLen=0; i<_ip_editCnt; i++)
+    {
+      e = &_ip_edits[i];
+      memcpy(_ip_ref + newLen, ref + pos, e->pos - pos);
+      newLen += e->pos - pos;
+      e->newPos = newLen;
+      memcpy(_ip_ref + newLen, e->alt, e->altLen);
+      newLen += e->altLen;
+      pos = e->pos + e->refLen;
+    }
+  memcpy(_ip_ref + newLen, ref + pos, len - pos);
+  newLen += len - pos;
+  _ip_ref[newLen] = '\0';
+
+  if (blockCnt * sizeof(int) > _ip_blockBytes)
+    {
+      if (_ip_firstEdit != NULL)
+	{
+	  freeMem(_ip_firstEdit, _ip_blockBytes);
+	  freeMem(_ip_shift, _ip_blockBytes);
+	}
+      _ip_blockBytes = blockCnt * sizeof(int);
+      _ip_firstEdit = getMem(_ip_blockBytes);
+      _ip_shift = getMem(_ip_blockBytes);
+    }
+
+  for (b=0, i=0; b<blockCnt; b++)
+    {
+      for (; i<_ip_editCnt && _ip_edits[i].pos + _ip_edits[i].refLen <= (b << IP_BLOCK_BITS); i++)
+	shift += (int)_ip_edits[i].altLen - (int)_ip_edits[i].refLen;
+      _ip_firstEdit[b] = i;
+      _ip_shift[b] = shift;
+    }
+  return newLen;
+}
+/**********************************************/
+// Patched 1-based location of the window at 1-based loc, 0 if the window
+// overlaps an edit
+static inline unsigned int mapIndexPatchLocation(unsigned int loc)
+{
+  unsigned int s = loc - 1, b = s >> IP_BLOCK_BITS;
+  unsigned int i = _ip_firstEdit[b];
+  int shift = _ip_shift[b];
+
+  for (; i<_ip_editCnt && _ip_edits[i].pos + _ip_edits[i].refLen <= s; i++)
+    shift += (int)_ip_edits[i].altLen - (int)_ip_edits[i].refLen;
+  if (i<_ip_editCnt && _ip_edits[i].pos < s + WINDOW_SIZE)
+    return 0;
+  return loc + shift;
+}
+/**********************************************/
+// Keys of the patched windows that overlap an edit, sorted by key then
+// location. Like the index build, the last window of the chunk is left out.
+unsigned int hashIndexPatchWindows(unsigned int newLen)
+{
+  unsigned int limit = (newLen > WINDOW_SIZE) ? newLen - WINDOW_SIZE : 0;
+  unsigned int i, s, from, to, next = 0, n = 0;
+  int seedLoops = (seedCnt) ? seedCnt : 1;
+  size_t need = 0;
+  long long hv;
+  int m;
+
+  for (i=0; i<_ip_editCnt; i++)
+    need += (_ip_edits[i].altLen + WINDOW_SIZE) * seedLoops;
+  if (need > _ip_newPairCnt)
+    {
+      if (_ip_newKeys != NULL)
+	{
+	  freeMem(_ip_newKeys, sizeof(unsigned long long) * _ip_newPairCnt);
+	  freeMem(_ip_tmpKeys, sizeof(unsigned long long) * _ip_newPairCnt);
+	  freeMem(_ip_newLocs, sizeof(unsigned int) * _ip_newPairCnt);
+	  freeMem(_ip_tmpLocs, sizeof(unsigned int) * _ip_newPairCnt);
+	}
+      _ip_newPairCnt = need;
+      _ip_newKeys = getMem(sizeof(unsigned long long) * need);
+      _ip_tmpKeys = getMem(sizeof(unsigned long long) * need);
+      _ip_newLocs = getMem(sizeof(unsigned int) * need);
+      _ip_tmpLocs = getMem(sizeof(unsigned int) * need);
+    }
+
+  for (i=0; i<_ip_editCnt; i++)
+    {
+      from = (_ip_edits[i].newPos + 1 > WINDOW_SIZE) ? _ip_edits[i].newPos + 1 - WINDOW_SIZE : 0;
+      to = _ip_edits[i].newPos + _ip_edits[i].altLen;
+      if (from < next)
+	from = next;
+      if (to > limit)
+	to = limit;
+      for (s=from; s<to; s++)
+	for (m=0; m<seedLoops; m++)
+	  {
+	    hv = hashSeedVal(_ip_ref + s, m);
+	    if (hv == -1)
+	      continue;
+	    _ip_newKeys[n] = hv;
+	    _ip_newLocs[n++] = s + 1;
+	  }
+      if (to > next)
+	next = to;
+    }
+
+  sortKHashTablePairs(_ip_newKeys, _ip_newLocs, _ip_tmpKeys, _ip_tmpLocs, n);
+  return n;
+}
+/**********************************************/
+// Merges the remapped locations of the loaded chunk, main and overflow keys,
+// with the new windows into the (key, location) pairs of the patched chunk
+unsigned int mergeIndexPatchKeys(unsigned int newCnt)
+{
+  IndexChunk *chunk = getIndexChunk();
+  unsigned int keyCnt = chunk->keyCnt, total = getIndexKeyCount();
+  unsigned int a = 0, b = keyCnt, c = 0, n = 0, i, loc, *old;
+  unsigned long long ka, kb, key;
+  size_t need = (size_t)chunk->locCnt + chunk->overflowLocCnt + newCnt;
+
+  if (need > _ip_pairCnt)
+    {
+      if (_ip_keys != NULL)
+	{
+	  freeMem(_ip_keys, sizeof(unsigned long long) * _ip_pairCnt);
+	  freeMem(_ip_locs, sizeof(unsigned int) * _ip_pairCnt);
+	}
+      _ip_pairCnt = need;
+      _ip_keys = getMem(sizeof(unsigned long long) * need);
+      _ip_locs = getMem(sizeof(unsigned int) * need);
+    }
+
+  while (a < keyCnt || b < total || c < newCnt)
+    {
+      ka = kb = key = ~0ULL;
+      if (a < keyCnt)
+	getIndexKey(a, &ka);
+      if (b < total)
+	getIndexKey(b, &kb);
+      key = (ka < kb) ? ka : kb;
+      if (c < newCnt && _ip_newKeys[c] < key)
+	key = _ip_newKeys[c];
+
+      old = NULL;
+      if (ka == key)
+	old = getIndexKey(a++, &ka);
+      else if (kb == key)
+	old = getIndexKey(b++, &kb);
+
+      // Both lists are sorted and the coordinate map keeps the order
+      for (i = 1; old != NULL && i <= old[0]; i++)
+	{
+	  loc = mapIndexPatchLocation(old[i]);
+	  if (loc == 0)
+	    continue;
+	  for (; c < newCnt && _ip_newKeys[c] == key && _ip_newLocs[c] < loc; c++)
+	    {
+	      _ip_keys[n] = key;
+	      _ip_locs[n++] = _ip_newLocs[c];
+	    }
+	  _ip_keys[n] = key;
+	  _ip_locs[n++] = loc;
+	}
+      for (; c < newCnt && _ip_newKeys[c] == key; c++)
+	{
+	  _ip_keys[n] = key;
+	  _ip_locs[n++] = _ip_newLocs[c];
+	}
+    }
+  return n;
+}
+/**********************************************/
+void freeIndexPatch()
+{
+  if (_ip_vars != NULL)
+    freeMem(_ip_vars, _ip_varBytes);
+  if (_ip_seqs != NULL)
+    freeMem(_ip_seqs, _ip_seqBytes);
+  if (_ip_contigs != NULL)
+    freeMem(_ip_contigs, _ip_contigBytes);
+  if (_ip_edits != NULL)
+    freeMem(_ip_edits, _ip_editBytes);
+  if (_ip_ref != NULL)
+    freeMem(_ip_ref, _ip_refBytes);
+  if (_ip_firstEdit != NULL)
+    {
+      freeMem(_ip_firstEdit, _ip_blockBytes);
+      freeMem(_ip_shift, _ip_blockBytes);
+    }
+  if (_ip_keys != NULL)
+    {
+      freeMem(_ip_keys, sizeof(unsigned long long) * _ip_pairCnt);
+      freeMem(_ip_locs, sizeof(unsigned int) * _ip_pairCnt);
+    }
+  if (_ip_newKeys != NULL)
+    {
+      freeMem(_ip_newKeys, sizeof(unsigned long long) * _ip_newPairCnt);
+      freeMem(_ip_tmpKeys, sizeof(unsigned long long) * _ip_newPairCnt);
+      freeMem(_ip_newLocs, sizeof(unsigned int) * _ip_newPairCnt);
+      freeMem(_ip_tmpLocs, sizeof(unsigned int) * _ip_newPairCnt);
+    }
+  freeMem(_ip_tail, CONTIG_OVERLAP + 1);
+  _ip_vars = NULL;
+  _ip_seqs = NULL;
+  _ip_contigs = NULL;
+  _ip_edits = NULL;
+  _ip_ref = NULL;
+  _ip_firstEdit = NULL;
+  _ip_shift = NULL;
+  _ip_keys = _ip_newKeys = _ip_tmpKeys = NULL;
+  _ip_locs = _ip_newLocs = _ip_tmpLocs = NULL;
+  _ip_tail = NULL;
+  _ip_varCnt = _ip_varBytes = _ip_seqSize = _ip_seqBytes = _ip_contigCnt = _ip_contigBytes = 0;
+  _ip_editBytes = _ip_refBytes = _ip_blockBytes = _ip_pairCnt = _ip_newPairCnt = 0;
+}
+/**********************************************/
+// Writes the index of the consensus of the reference and the variants of
+// vcfFile to patchName without rebuilding it: every chunk of the reference
+// index gets the variants applied to its reference, the locations of its
+// windows that no variant touches are shifted by the indels before them, and
+// only the windows over a variant are hashed again. The patched chunks keep
+// the chunk boundaries and the CONTIG_OVERLAP overlap of the reference.
+int patchIndex(char *indexName, char *vcfFile, char *patchName)
+{
+  double startTime = getTime();
+  double loadTime;
+  unsigned int len, newLen, newCnt, n;
+  int offset, c;
+  char name[CONTIG_NAME_SIZE];
+
+  if (!loadIndexPatchVariants(vcfFile))
+    return 0;
+  if (!initPatchingHashTable(indexName, patchName))
+    return 0;
+  _ip_tail = getMem(CONTIG_OVERLAP + 1);
+
+  fprintf(stderr, "Patching %s with %s", indexName, vcfFile);
+  fflush(stderr);
+
+  while (loadHashTable(&loadTime))
+    {
+      snprintf(name, CONTIG_NAME_SIZE, "%s", getRefGenomeName());
+      len = getIndexChunk()->refGenLength;
+      offset = getRefGenomeOffset();
+
+      if (offset == 0)
+	{
+	  c = findIndexPatchContig(name);
+	  _ip_cursor = (c >= 0) ? _ip_contigs[c].first : 0;
+	  _ip_cursorEnd = (c >= 0) ? _ip_contigs[c].end : 0;
+	  fprintf(stderr, "\n - %s ", name);
+	}
+      else
+	fprintf(stderr, ".");
+      fflush(stderr);
+
+      collectIndexPatchEdits(getRefGenome(), len, offset);
+      newLen = applyIndexPatchEdits(getRefGenome(), len);
+      newCnt = hashIndexPatchWindows(newLen);
+      n = mergeIndexPatchKeys(newCnt);
+
+      if (offset > 0)
+	offset = _ip_newOffset + _ip_newLength - CONTIG_OVERLAP;
+      savePatchedHashTable(_ip_keys, _ip_locs, n, _ip_ref, name, offset);
+
+      _ip_newOffset = offset;
+      _ip_newLength = newLen;
+      if (newLen >= CONTIG_OVERLAP)
+	memcpy(_ip_tail, _ip_ref + newLen - CONTIG_OVERLAP, CONTIG_OVERLAP);
+      _ip_tail[CONTIG_OVERLAP] = '\0';
+    }
+
+  finalizePatchingHashTable();
+  fprintf(stderr, "\n%u variants applied; %u symbolic or overlapping, %u not matching the reference and %u across chunks skipped.\n",
+	  _ip_applied, _ip_skipped, _ip_mismatched, _ip_crossing);
+  freeIndexPatch();
+
+  fprintf(stderr, "DONE in %0.2fs!\n", (getTime()-startTime));
+  return 1;
+}
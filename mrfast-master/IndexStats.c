@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) <2008 - 2020>, University of Washington, Simon Fraser University, 
+ * Bilkent University and Carnegie Mellon University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice, this
+ *   list of conditions and the following disclaimer in the documentation and/or other
+ *   materials provided with the distribution.
+ * - Neither the names of the University of Washington, Simon Fraser University, 
+ *   Bilkent University, Carnegie Mellon University,
+ *   nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+  Authors: 
+  Farhad Hormozdiari
+	  farhadh AT uw DOT edu
+  Faraz Hach
+	  fhach AT cs DOT sfu DOT ca
+  Can Alkan
+	  calkan AT gmail DOT com
+  Hongyi Xin
+	  gohongyi AT gmail DOT com
+  Donghyuk Lee
+	  bleups AT gmail DOT com
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Common.h"
+#include "Reads.h"
+#include "HashTable.h"
+#include "IndexStats.h"
+
+#define IS_HIST_SIZE	33			// Bins of the key size histogram: 1, 2-3, 4-7, ...
+
+typedef struct
+{
+  unsigned long long	key;
+  unsigned int		cnt;
+  char			name[CONTIG_NAME_SIZE];
+} IndexStatsKey;
+
+typedef struct
+{
+  char			name[CONTIG_NAME_SIZE];
+  unsigned int		chunkCnt;
+  unsigned long long	length;
+  unsigned long long	keyCnt;
+  unsigned long long	locCnt;
+} IndexStatsContig;
+
+unsigned long long	_is_histKeys[IS_HIST_SIZE];
+unsigned long long	_is_histLocs[IS_HIST_SIZE];
+IndexStatsKey		*_is_top		= NULL;	// Min-heap of the heaviest keys
+int			_is_topCnt		= 0;
+int			_is_topSize		= 0;
+IndexStatsContig	*_is_contigs		= NULL;
+int			_is_contigCnt		= 0;
+int			_is_contigCapacity	= 0;
+/**********************************************/
+void siftIndexStatsHeap(int i)
+{
+  IndexStatsKey tmp;
+  int c;
+
+  while ((c = 2*i + 1) < _is_topCnt)
+    {
+      if (c + 1 < _is_topCnt && _is_top[c+1].cnt < _is_top[c].cnt)
+	c++;
+      if (_is_top[i].cnt <= _is_top[c].cnt)
+	break;
+      tmp = _is_top[i];
+      _is_top[i] = _is_top[c];
+      _is_top[c] = tmp;
+      i = c;
+    }
+}
+/**********************************************/
+void addIndexStatsKey(unsigned long long key, unsigned int cnt, char *name)
+{
+  IndexStatsKey tmp;
+  int i, p;
+
+  if (_is_topSize == 0 || (_is_topCnt == _is_topSize && cnt <= _is_top[0].cnt))
+    return;
+
+  if (_is_topCnt == _is_topSize)
+    {
+      _is_top[0].key = key;
+      _is_top[0].cnt = cnt;
+      snprintf(_is_top[0].name, CONTIG_NAME_SIZE, "%s", name);
+      siftIndexStatsHeap(0);
+      return;
+    }
+
+  i = _is_topCnt++;
+  _is_top[i].key = key;
+  _is_top[i].cnt = cnt;
+  snprintf(_is_top[i].name, CONTIG_NAME_SIZE, "%s", name);
+  while (i > 0 && _is_top[p = (i-1)/2].cnt > _is_top[i].cnt)
+    {
+      tmp = _is_top[i];
+      _is_top[i] = _is_top[p];
+      _is_top[p] = tmp;
+      i = p;
+    }
+}
+/**********************************************/
+int compareIndexStatsKey(const void *a, const void *b)
+{
+  unsigned int x = ((IndexStatsKey *)a)->cnt, y = ((IndexStatsKey *)b)->cnt;
+  return (x < y) - (x > y);
+}
+/**********************************************/
+// Chunks of a contig are consecutive in the index
+void addIndexStatsContig(char *name, unsigned int length, unsigned long long keyCnt, unsigned long long locCnt)
+{
+  IndexStatsContig *c;
+
+  if (_is_contigCnt == 0 || strcmp(_is_contigs[_is_contigCnt-1].name, name) != 0)
+    {
+      if (_is_contigCnt == _is_contigCapacity)
+	{
+	  int newCapacity = (_is_contigCapacity == 0) ? 64 : 2 * _is_contigCapacity;
+	  IndexStatsContig *tmp = getMem(sizeof(IndexStatsContig) * newCapacity);
+	  if (_is_contigs != NULL)
+	    {
+	      memcpy(tmp, _is_contigs, sizeof(IndexStatsContig) * _is_contigCnt);
+	      freeMem(_is_contigs, sizeof(IndexStatsContig) * _is_contigCapacity);
+	    }
+	  _is_contigs = tmp;
+	  _is_contigCapacity = newCapacity;
+	}
+      c = &_is_contigs[_is_contigCnt++];
+      memset(c, 0, sizeof(IndexStatsContig));
+      snprintf(c->name, CONTIG_NAME_SIZE, "%s", name);
+    }
+
+  c = &_is_contigs[_is_contigCnt-1];
+  c->chunkCnt++;
+  c->length += length;
+  c->keyCnt += keyCnt;
+  c->locCnt += locCnt;
+}
+/**********************************************/
+// Adds the candidates of every window of the probes in the loaded chunk;
+// cand holds windowCnt forward and windowCnt reverse counts per probe
+void countIndexStatsProbes(Read *probes, unsigned int probeCnt, int windowCnt, unsigned long long *cand)
+{
+  int offsets[SEQ_MAX_LENGTH];
+  unsigned int i, *locs;
+  int d, w, n;
+  long long hv;
+  char *seq;
+
+  for (i=0; i<probeCnt; i++)
+    for (d=0; d<2; d++)
+      {
+	seq = (d) ? probes[i].rseq : probes[i].seq;
+	n = getSeedOffsets(seq, strlen(seq), offsets);
+	for (w=0; w<n && w<windowCnt; w++)
+	  {
+	    hv = hashSeedVal(seq + offsets[w], w);
+	    locs = getCandidates(hv);
+	    if (locs == NULL)
+	      locs = getOverflowCandidates(hv);
+	    if (locs != NULL)
+	      cand[(2*i + d)*windowCnt + w] += locs[0];
+	  }
+      }
+}
+/**********************************************/
+void printIndexStatsProbes(Read *probes, unsigned int probeCnt, int windowCnt, unsigned long long *cand)
+{
+  unsigned long long fwd, rev, max, c;
+  unsigned int i;
+  int w;
+
+  printf("\n# Probes\n");
+  printf("#Name\tForward\tReverse\tTotal\tMaxWindow\tWindows\n");
+  for (i=0; i<probeCnt; i++)
+    {
+      fwd = rev = max = 0;
+      for (w=0; w<windowCnt; w++)
+	{
+	  fwd += cand[2*i*windowCnt + w];
+	  rev += cand[(2*i+1)*windowCnt + w];
+	  c = cand[2*i*windowCnt + w] + cand[(2*i+1)*windowCnt + w];
+	  if (c > max)
+	    max = c;
+	}
+      printf("%s\t%llu\t%llu\t%llu\t%llu\t", probes[i].name, fwd, rev, fwd + rev, max);
+      for (w=0; w<windowCnt; w++)
+	printf("%s%llu", (w) ? "," : "", cand[2*i*windowCnt + w] + cand[(2*i+1)*windowCnt + w]);
+      printf("\n");
+    }
+}
+/**********************************************/
+// Streams the chunks of the index and prints the chunk sizes, the per contig
+// counts, the histogram of the number of locations per key, the heaviest
+// keys and, for a probe file, the candidates every probe window looks up.
+int printIndexStats(char *indexName, char *probeFile, int top)
+{
+  Read			*probes		= NULL;
+  unsigned int		probeCnt	= 0;
+  unsigned long long	*cand		= NULL;
+  int			windowCnt	= 0;
+  unsigned long long	keyCnt, locCnt, key, tableBytes;
+  unsigned int		k, n, *locs;
+  IndexChunk		*chunk;
+  char			*name;
+  char			seq[64];
+  double		loadTime;
+  int			i, b;
+
+  if (probeFile != NULL && !readAllReads(probeFile, NULL, seqCompressed, &seqFastq, 0, &probes, &probeCnt))
+    return 0;
+
+  if (!initLoadingHashTable(indexName))
+    return 0;
+
+  if (probeFile != NULL)
+    {
+      for (k=0; k<probeCnt; k++)
+	if (strlen(probes[k].seq) / WINDOW_SIZE > windowCnt)
+	  windowCnt = strlen(probes[k].seq) / WINDOW_SIZE;
+      cand = getMem(sizeof(unsigned long long) * 2 * probeCnt * windowCnt);
+      memset(cand, 0, sizeof(unsigned long long) * 2 * probeCnt * windowCnt);
+    }
+
+  _is_topSize = top;
+  _is_topCnt = 0;
+  if (top > 0)
+    _is_top = getMem(sizeof(IndexStatsKey) * top);
+  memset(_is_histKeys, 0, sizeof(_is_histKeys));
+  memset(_is_histLocs, 0, sizeof(_is_histLocs));
+
+  printf("# Index %s, window size %d\n", indexName, WINDOW_SIZE);
+  printf("\n# Chunks\n");
+  printf("#Name\tOffset\tLength\tKeys\tLocations\tOverflowKeys\tRefMB\tTableMB\tOverflowMB\tHeapMB\n");
+
+  while (loadHashTable(&loadTime))
+    {
+      name = getRefGenomeName();
+      keyCnt = locCnt = 0;
+
+      n = getIndexKeyCount();
+      for (k=0; k<n; k++)
+	{
+	  locs = getIndexKey(k, &key);
+	  if (locs == NULL || locs[0] == 0)
+	    continue;
+	  for (b=0; b < IS_HIST_SIZE - 1 && (2U << b) <= locs[0]; b++);
+	  _is_histKeys[b]++;
+	  _is_histLocs[b] += locs[0];
+	  keyCnt++;
+	  locCnt += locs[0];
+	  addIndexStatsKey(key, locs[0], name);
+	}
+
+      chunk = getIndexChunk();
+      if (chunk != NULL)
+	{
+	  // FM-indexes have no keys; their locations are the BWT rows
+	  if (n == 0)
+	    locCnt = chunk->locCnt;
+	  tableBytes = (chunk->overflowOffset > chunk->offset) ? chunk->overflowOffset - chunk->offset - chunk->refBytes : chunk->locBytes;
+	  printf("%s\t%d\t%u\t%llu\t%llu\t%u\t%.2f\t%.2f\t%.2f\t%.2f\n", name, getRefGenomeOffset(),
+		 chunk->refGenLength, keyCnt, locCnt, chunk->overflowKeyCnt,
+		 chunk->refBytes / 1048576.0, tableBytes / 1048576.0,
+		 (12.0 * chunk->overflowKeyCnt + 4.0 * (chunk->overflowKeyCnt + chunk->overflowLocCnt)) / 1048576.0,
+		 getMemUsage());
+	  addIndexStatsContig(name, chunk->refGenLength, keyCnt, locCnt);
+	}
+      else
+	{
+	  printf("%s\t%d\t%u\t%llu\t%llu\t0\t%.2f\t%.2f\t0.00\t%.2f\n", name, getRefGenomeOffset(),
+		 (unsigned int)strlen(getRefGenome()), keyCnt, locCnt,
+		 strlen(getRefGenome()) / 1048576.0, 4.0 * (keyCnt + locCnt) / 1048576.0, getMemUsage());
+	  addIndexStatsContig(name, strlen(getRefGenome()), keyCnt, locCnt);
+	}
+
+      if (cand != NULL)
+	countIndexStatsProbes(probes, probeCnt, windowCnt, cand);
+    }
+
+  printf("\n# Contigs\n");
+  printf("#Name\tChunks\tLength\tKeys\tLocations\n");
+  for (i=0; i<_is_contigCnt; i++)
+    printf("%s\t%u\t%llu\t%llu\t%llu\n", _is_contigs[i].name, _is_contigs[i].chunkCnt,
+	   _is_contigs[i].length, _is_contigs[i].keyCnt, _is_contigs[i].locCnt);
+
+  printf("\n# Locations per key\n");
+  printf("#Min\tMax\tKeys\tLocations\n");
+  for (b=0; b<IS_HIST_SIZE; b++)
+    if (_is_histKeys[b] > 0)
+      printf("%llu\t%llu\t%llu\t%llu\n", 1ULL << b, (2ULL << b) - 1, _is_histKeys[b], _is_histLocs[b]);
+
+  if (_is_topCnt > 0)
+    {
+      qsort(_is_top, _is_topCnt, sizeof(IndexStatsKey), compareIndexStatsKey);
+      printf("\n# Heaviest keys\n");
+      printf("#Key\tLocations\tName\n");
+      for (i=0; i<_is_topCnt; i++)
+	{
+	  decodeHashVal(_is_top[i].key, seq);
+	  printf("%s\t%u\t%s\n", seq, _is_top[i].cnt, _is_top[i].name);
+	}
+    }
+
+  if (cand != NULL)
+    {
+      printIndexStatsProbes(probes, probeCnt, windowCnt, cand);
+      freeMem(cand, sizeof(unsigned long long) * 2 * probeCnt * windowCnt);
+    }
+
+  finalizeLoadingHashTable();
+  if (_is_top != NULL)
+    freeMem(_is_top, sizeof(IndexStatsKey) * _is_topSize);
+  if (_is_contigs != NULL)
+    freeMem(_is_contigs, sizeof(IndexStatsContig) * _is_contigCapacity);
+  _is_top = NULL;
+  _is_contigs = NULL;
+  _is_contigCnt = _is_contigCapacity = 0;
+  return 1;
+}
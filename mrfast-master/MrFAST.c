@@ -71,6 +71,7 @@ char *versionNumberF = "1.0";
 
 long long verificationCnt = 0;
 long long mappingCnt = 0;
+long long skippedCandidateCnt = 0;
 long long mappedSeqCnt = 0;
 long long completedSeqCnt = 0;
 char *mappingOutput;
@@ -79,6 +80,8 @@ char *_msf_refGen = NULL;
 int _msf_refGenLength = 0;
 int _msf_refGenOffset = 0;
 char *_msf_refGenName = NULL;
+int _msf_refGenAccess = 0;		// Hits read the reference through the .fai
+int _msf_refGenContig = -1;
 
 int _msf_refGenBeg;
 int _msf_refGenEnd;
@@ -801,7 +804,7 @@ void finalizeBestSingleMapping()
 }
 /**********************************************/
 int compare(const void *a, const void *b) {
-  return ((Pair *) a)->hv - ((Pair *) b)->hv;
+  return (((Pair *) a)->hv > ((Pair *) b)->hv) - (((Pair *) a)->hv < ((Pair *) b)->hv);
 }
 /**********************************************/
 void preProcessReads() {
@@ -953,7 +956,9 @@ void initFAST(Read *seqList, int seqListSize, int *samplingLocs,
       _msf_readHasConcordantMapping[i] = 0;
     }
 
-    initLoadingRefGenome(genFileName);
+    _msf_refGenAccess = initRefGenomeAccess(genFileName);
+    if (!_msf_refGenAccess)
+      initLoadingRefGenome(genFileName);
   }
 
   if (_msf_refGenOffset == 0) {
@@ -971,6 +976,8 @@ void finalizeFAST() {
 
   freeMem(_msf_sort_seqList, sizeof(int) * _msf_seqListSize);
 
+  if (_msf_refGenAccess)
+    finalizeRefGenomeAccess();
 }
 
 
@@ -989,6 +996,7 @@ int verifySingleEndEditDistanceExtension(int refIndex, char *lSeq,
 
   int error2 = 0;
   int error3 = 0;
+  int middleError = 0;
   int totalError = 0;
   //int errorSegment = 0;
 
@@ -1012,6 +1020,14 @@ int verifySingleEndEditDistanceExtension(int refIndex, char *lSeq,
   ref = _msf_refGen + refIndex - 1;
   tempref = _msf_refGen + refIndex - 1;
 
+  // Only the bases under the mask of a spaced seed are known to match
+  if (seedCnt) {
+    for (i = 0; i < segLength; i++)
+      middleError += (ref[i] != lSeq[lSeqLength + i]);
+    if (middleError > errThreshold)
+      return -1;
+  }
+
   if (lSeqLength != 0) {
     error3 = backwardEditDistanceSSE2Extension(ref - 1, lSeqLength,
 					       lSeq + lSeqLength - 1, lSeqLength);
@@ -1027,7 +1043,7 @@ int verifySingleEndEditDistanceExtension(int refIndex, char *lSeq,
       return -1;
   }
 
-  if (error2 + error3 > errThreshold)
+  if (error2 + error3 + middleError > errThreshold)
     return -1;
 
   rIndex = 1;
@@ -1193,14 +1209,14 @@ int verifySingleEndEditDistanceExtension(int refIndex, char *lSeq,
     minIndex2 = rSeqLength;
   }
 
-  totalError = error + error1;
+  totalError = error + error1 + middleError;
 
   /* Farhad 08/07/2012 */
   if(totalError > errThreshold)
     return -1;
   /* Farhad 08/07/2012 */
 
-  if (debugMode && totalError != error2 + error3) {
+  if (debugMode && totalError != error2 + error3 + middleError) {
     for (i = 0; i < lSeqLength; i++)
       fprintf(stderr, "%c", *(tempref - 1 - i));
     fprintf(stderr, "\n");
@@ -1372,7 +1388,7 @@ int verifySingleEndEditDistanceExtension(int refIndex, char *lSeq,
   char middle[SEQ_MAX_LENGTH];
   middle[0] = '\0';
   for (i = 0; i < segLength; i++)
-    middle[i] = 'M';
+    middle[i] = (tempref[i] == lSeq[lSeqLength + i]) ? 'M' : tempref[i];
   middle[segLength] = '\0';
 
   char rmatrixR[SEQ_MAX_LENGTH];
@@ -1663,7 +1679,7 @@ int searchKey(int target_coor, unsigned int* entry_coor, int entry_size) {
 /************************************************/
 /* MrFAST with fastHASH: compareEntrySize()		*/
 /************************************************/
-void mapSingleEndSeq(unsigned int *l1, int s1, int readNumber, int readSegment,
+void mapSingleEndSeq(unsigned int *l1, int s1, int readNumber, int readOffset,
 		     int direction, int index, key_struct* keys_input,
 		     int potential_key_number) {
   int j = 0;
@@ -1727,8 +1743,8 @@ void mapSingleEndSeq(unsigned int *l1, int s1, int readNumber, int readSegment,
     if (mergeIdx < potential_key_number) {
       if (!searchKey(
 		     genLoc
-		     + (keys_input[mergeIdx].key_number
-			- keys_input[o].key_number) * WINDOW_SIZE,
+		     + keys_input[mergeIdx].key_offset
+		     - keys_input[o].key_offset,
 		     keys_input[mergeIdx].key_entry,
 		     keys_input[mergeIdx].key_entry_size)) {
 	continue;
@@ -1748,9 +1764,8 @@ void mapSingleEndSeq(unsigned int *l1, int s1, int readNumber, int readSegment,
       if (ix != o && ix != mergeIdx) { // Changed with long-K
 	if (!searchKey(
 		       genLoc
-		       + (keys_input[ix].key_number
-			  - keys_input[o].key_number)
-		       * WINDOW_SIZE, keys_input[ix].key_entry,
+		       + keys_input[ix].key_offset
+		       - keys_input[o].key_offset, keys_input[ix].key_entry,
 		       keys_input[ix].key_entry_size)) {
 	  diff_num++;
 	  if (diff_num > errThreshold) {
@@ -1791,9 +1806,9 @@ void mapSingleEndSeq(unsigned int *l1, int s1, int readNumber, int readSegment,
     
 
     for (j = -errThreshold+1; j < errThreshold; j++) {
-      if(genLoc-(readSegment*WINDOW_SIZE)+j >= _msf_refGenBeg &&
-	 genLoc-(readSegment*WINDOW_SIZE)+j <= _msf_refGenEnd){
-	_msf_verifiedLocs[genLoc-(readSegment*WINDOW_SIZE)+j] = readId;
+      if(genLoc-(readOffset)+j >= _msf_refGenBeg &&
+	 genLoc-(readOffset)+j <= _msf_refGenEnd){
+	_msf_verifiedLocs[genLoc-(readOffset)+j] = readId;
       }
     }
       
@@ -1879,6 +1894,73 @@ int compareEntrySize(const void *a, const void *b) {
 	  - (*(key_struct*) b).key_entry_size);
 }
 
+/************************************************/
+/* MrFAST with fastHASH: collectKeys()			*/
+/************************************************/
+// Collects the keys of seq that have candidates. Keys above maxKeyFrequency
+// and keys of the overflow table are only used when the read has no other
+// key; otherwise their candidates are counted as skipped. Backends with
+// variable length seeds first try to extend such keys to the left.
+int collectKeys(char *seq, key_struct *keys) {
+  int key_number = SEQ_LENGTH / WINDOW_SIZE;
+  int offsets[SEQ_MAX_LENGTH];
+  int offset_num = getSeedOffsets(seq, SEQ_LENGTH, offsets);
+  int available_key_num = 0;
+  int heavy_key_num = 0;
+  long long skipped = 0;
+  long long hv;
+  unsigned int *locs;
+  unsigned int cnt;
+  int it;
+
+  for (it = 0; it < offset_num; it++) {
+    if (getSeedCandidates != NULL && maxKeyFrequency > 0) {
+      locs = getSeedCandidates(seq + offsets[it], offsets[it], maxKeyFrequency, &cnt);
+      if (locs == NULL && cnt == 0)
+	continue;
+      if (locs != NULL)
+	cnt = locs[0];
+    } else {
+      hv = hashSeedVal(seq + offsets[it], it);
+      locs = getCandidates(hv);
+      if (locs == NULL)
+	locs = getOverflowCandidates(hv);
+      if (locs == NULL)
+	continue;
+      cnt = locs[0];
+    }
+
+    // Heavy keys are kept at the end of keys; their locations may be left
+    // out until they are needed
+    if (maxKeyFrequency == 0 || cnt <= maxKeyFrequency) {
+      keys[available_key_num].key_number = it;
+      keys[available_key_num].key_offset = offsets[it];
+      keys[available_key_num].key_entry = locs;
+      keys[available_key_num].key_entry_size = cnt;
+      available_key_num++;
+    } else {
+      heavy_key_num++;
+      keys[key_number - heavy_key_num].key_number = it;
+      keys[key_number - heavy_key_num].key_offset = offsets[it];
+      keys[key_number - heavy_key_num].key_entry = locs;
+      keys[key_number - heavy_key_num].key_entry_size = cnt;
+      skipped += cnt;
+    }
+  }
+
+  if (available_key_num > 0) {
+    skippedCandidateCnt += skipped;
+    return available_key_num;
+  }
+
+  for (it = 0; it < heavy_key_num; it++) {
+    keys[it] = keys[key_number - heavy_key_num + it];
+    if (keys[it].key_entry == NULL)
+      keys[it].key_entry = getCandidates(hashSeedVal(seq + keys[it].key_offset, keys[it].key_number));
+  }
+  return heavy_key_num;
+}
+
 /************************************************/
 /* MrFAST with fastHASH: mapAllSingleEndSeq()	*/
 /************************************************/
@@ -1886,25 +1968,13 @@ int mapAllSingleEndSeq() {
   int i = 0;
   int j = 0;
   int k = 0;
-  int it = 0;
-  unsigned int *locs = NULL;
   int key_number = SEQ_LENGTH / WINDOW_SIZE;
   key_struct* sort_input = getMem(key_number * sizeof(key_struct));
 
   // Forward Mode
   for (i = 0; i < _msf_seqListSize; i++) {
     k = _msf_sort_seqList[i].readNumber;
-    int available_key_num = 0;
-    for (it = 0; it < key_number; it++) {
-      locs = getCandidates(hashVal(_msf_seqList[k].seq + it * WINDOW_SIZE));
-
-      if (locs != NULL) {
-	sort_input[available_key_num].key_number = it;
-	sort_input[available_key_num].key_entry = locs;
-	sort_input[available_key_num].key_entry_size = locs[0];
-	available_key_num++;
-      }
-    }
+    int available_key_num = collectKeys(_msf_seqList[k].seq, sort_input);
 
     int operating_key_num = _msf_samplingLocsSize;
     if (available_key_num < operating_key_num) {
@@ -1915,9 +1985,9 @@ int mapAllSingleEndSeq() {
 	  compareEntrySize);
 
     for (j = 0; j < operating_key_num; j++) {
-      _msf_samplingLocs[j] = sort_input[j].key_number * WINDOW_SIZE;
+      _msf_samplingLocs[j] = sort_input[j].key_offset;
       mapSingleEndSeq(sort_input[j].key_entry + 1,
-		      sort_input[j].key_entry_size, k, sort_input[j].key_number,
+		      sort_input[j].key_entry_size, k, sort_input[j].key_offset,
 		      0, j, sort_input, available_key_num);
     }
   }
@@ -1925,18 +1995,7 @@ int mapAllSingleEndSeq() {
   // Reverse Mode
   for (i = 0; i < _msf_seqListSize; i++) {
     k = _msf_sort_seqList[i].readNumber;
-    int available_key_num = 0;
-    for (it = 0; it < key_number; it++) {
-      
-      locs = getCandidates(hashVal(_msf_seqList[k].rseq + it * WINDOW_SIZE));
-
-      if (locs != NULL) {
-	sort_input[available_key_num].key_number = it;
-	sort_input[available_key_num].key_entry = locs;
-	sort_input[available_key_num].key_entry_size = locs[0];
-	available_key_num++;
-      }
-    }
+    int available_key_num = collectKeys(_msf_seqList[k].rseq, sort_input);
 
     qsort(sort_input, available_key_num, sizeof(key_struct),
 	  compareEntrySize);
@@ -1947,9 +2006,9 @@ int mapAllSingleEndSeq() {
     }
 
     for (j = 0; j < operating_key_num; j++) {
-      _msf_samplingLocs[j] = sort_input[j].key_number * WINDOW_SIZE;
+      _msf_samplingLocs[j] = sort_input[j].key_offset;
       mapSingleEndSeq(sort_input[j].key_entry + 1,
-		      sort_input[j].key_entry_size, k, sort_input[j].key_number,
+		      sort_input[j].key_entry_size, k, sort_input[j].key_offset,
 		      1, j, sort_input, available_key_num);
     }
   }
@@ -1976,7 +2035,7 @@ int compareOut(const void *a, const void *b) {
 /* MrFAST with fastHASH: mapPairEndSeqList()	*/
 /************************************************/
 void mapPairEndSeqList(unsigned int *l1, int s1, int readNumber,
-		       int readSegment, int direction, int index, key_struct* keys_input,
+		       int readOffset, int direction, int index, key_struct* keys_input,
 		       int potential_key_number) {
   int z = 0;
   int *locs = (int *) l1;
@@ -2048,8 +2107,8 @@ void mapPairEndSeqList(unsigned int *l1, int s1, int readNumber,
     if (mergeIdx < potential_key_number) {
       if (!searchKey(
 		     genLoc
-		     + (keys_input[mergeIdx].key_number
-			- keys_input[o].key_number) * WINDOW_SIZE,
+		     + keys_input[mergeIdx].key_offset
+		     - keys_input[o].key_offset,
 		     keys_input[mergeIdx].key_entry,
 		     keys_input[mergeIdx].key_entry_size)) {
 	continue;
@@ -2070,9 +2129,8 @@ void mapPairEndSeqList(unsigned int *l1, int s1, int readNumber,
       if (ix != o && ix != mergeIdx) { // Changed with long-K
 	if (!searchKey(
 		       genLoc
-		       + (keys_input[ix].key_number
-			  - keys_input[o].key_number)
-		       * WINDOW_SIZE, keys_input[ix].key_entry,
+		       + keys_input[ix].key_offset
+		       - keys_input[o].key_offset, keys_input[ix].key_entry,
 		       keys_input[ix].key_entry_size)) {
 	  diff_num++;
 	  if (diff_num > errThreshold) {
@@ -2100,9 +2158,9 @@ void mapPairEndSeqList(unsigned int *l1, int s1, int readNumber,
     int j = 0;
 
     for (j = -errThreshold+1; j < errThreshold; j++) {
-      if(genLoc-(readSegment*WINDOW_SIZE)+j >= _msf_refGenBeg &&
-	 genLoc-(readSegment*WINDOW_SIZE)+j <= _msf_refGenEnd)
-	_msf_verifiedLocs[genLoc-(readSegment*WINDOW_SIZE)+j] = readId;
+      if(genLoc-(readOffset)+j >= _msf_refGenBeg &&
+	 genLoc-(readOffset)+j <= _msf_refGenEnd)
+	_msf_verifiedLocs[genLoc-(readOffset)+j] = readId;
     }
 
 
@@ -2165,25 +2223,13 @@ void mapPairedEndSeq() {
   int i = 0;
   int j = 0;
   int k = 0;
-  unsigned int *locs = NULL;
   int key_number = SEQ_LENGTH / WINDOW_SIZE;
   key_struct* sort_input = getMem(key_number * sizeof(key_struct));
 
   // Forward Mode
   for (i = 0; i < _msf_seqListSize; i++) {
     k = _msf_sort_seqList[i].readNumber;
-    int available_key_num = 0;
-    int it = 0;
-    for (it = 0; it < key_number; it++) {
-      //int key_hash = 
-      locs = getCandidates(hashVal(_msf_seqList[k].seq + it * WINDOW_SIZE));
-      if (locs != NULL) {
-	sort_input[available_key_num].key_number = it;
-	sort_input[available_key_num].key_entry = locs;
-	sort_input[available_key_num].key_entry_size = locs[0];
-	available_key_num++;
-      }
-    }
+    int available_key_num = collectKeys(_msf_seqList[k].seq, sort_input);
 
     int operating_key_num = _msf_samplingLocsSize;
     if (available_key_num < operating_key_num) {
@@ -2194,9 +2240,9 @@ void mapPairedEndSeq() {
 	  compareEntrySize);
 
     for (j = 0; j < operating_key_num; j++) {
-      _msf_samplingLocs[j] = sort_input[j].key_number * WINDOW_SIZE;
+      _msf_samplingLocs[j] = sort_input[j].key_offset;
       mapPairEndSeqList(sort_input[j].key_entry + 1,
-			sort_input[j].key_entry_size, k, sort_input[j].key_number,
+			sort_input[j].key_entry_size, k, sort_input[j].key_offset,
 			0, j, sort_input, available_key_num);
     }
   }
@@ -2204,20 +2250,7 @@ void mapPairedEndSeq() {
   // Reverse Mode
   for (i = 0; i < _msf_seqListSize; i++) {
     k = _msf_sort_seqList[i].readNumber;
-    int key_number = SEQ_LENGTH / WINDOW_SIZE;
-    int available_key_num = 0;
-    int it = 0;
-    for (it = 0; it < key_number; it++) {
-      //int key_hash = 
-      locs = getCandidates(hashVal(_msf_seqList[k].rseq + it * WINDOW_SIZE));
-
-      if (locs != NULL) {
-	sort_input[available_key_num].key_number = it;
-	sort_input[available_key_num].key_entry = locs;
-	sort_input[available_key_num].key_entry_size = locs[0];
-	available_key_num++;
-      }
-    }
+    int available_key_num = collectKeys(_msf_seqList[k].rseq, sort_input);
 
     int operating_key_num = _msf_samplingLocsSize;
     if (available_key_num < operating_key_num) {
@@ -2228,9 +2261,9 @@ void mapPairedEndSeq() {
 	  compareEntrySize);
 
     for (j = 0; j < operating_key_num; j++) {
-      _msf_samplingLocs[j] = sort_input[j].key_number * WINDOW_SIZE;
+      _msf_samplingLocs[j] = sort_input[j].key_offset;
       mapPairEndSeqList(sort_input[j].key_entry + 1,
-			sort_input[j].key_entry_size, k, sort_input[j].key_number,
+			sort_input[j].key_entry_size, k, sort_input[j].key_offset,
 			1, j, sort_input, available_key_num);
     }
   }
@@ -2638,7 +2671,17 @@ void outputPairedEnd() {
   char rqual2[SEQ_LENGTH + 1];
   int tmp = 0;
 
-  loadRefGenome(&_msf_refGen, &_msf_refGenName, &tmpOut);
+  // The hits of the contig just mapped are scored against the bases fetched
+  // through the .fai; without it the reference is read again in order
+  if (_msf_refGenAccess) {
+    _msf_refGenContig = getRefGenomeContig(_msf_refGenName);
+    if (_msf_refGenContig < 0) {
+      fprintf(stderr, "Error: %s is not in the .fai of the reference genome.\n", _msf_refGenName);
+      exit(0);
+    }
+  } else {
+    loadRefGenome(&_msf_refGen, &_msf_refGenName, &tmpOut);
+  }
 
   if (pairedEndDiscordantMode) {
     sprintf(fname3, "%s__%s__disc", mappingOutputPath, mappingOutput);
@@ -3319,6 +3362,12 @@ float calculateScore(int index, char *seq, char *qual, char *md) {
 
   tmp[end] = '\0';
 
+  if (_msf_refGenAccess) {
+    for (i = 0, j = 0; i < end; i++)
+      j += (tmp[i] != 'I');
+    ref = getRefGenomeRange(_msf_refGenContig, index, j);
+  }
+
   j = 0;
 
   for (i = 0; i < end; i++) {
@@ -3755,17 +3804,20 @@ void finalizeOEAReads(char *fileName) {
     } else {
       seq1 = _msf_seqList[rNo].seq;
       qual1 = _msf_seqList[rNo].qual;
-      qual1[SEQ_LENGTH] = '\0';
+      if (seqFastq)
+	qual1[SEQ_LENGTH] = '\0';
     }
 
     if (rNo % 2 == 0) {
       seq2 = _msf_seqList[rNo + 1].seq;
       qual2 = _msf_seqList[rNo + 1].qual;
-      qual2[SEQ_LENGTH] = '\0';
+      if (seqFastq)
+	qual2[SEQ_LENGTH] = '\0';
     } else {
       seq2 = _msf_seqList[rNo - 1].seq;
       qual2 = _msf_seqList[rNo - 1].qual;
-      qual2[SEQ_LENGTH] = '\0';
+      if (seqFastq)
+	qual2[SEQ_LENGTH] = '\0';
     }
 
     
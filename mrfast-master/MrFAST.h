@@ -55,7 +55,7 @@
 // Pair is used to pre-processing and making the read index table
 typedef struct
 {
-  int hv;
+  long long hv;
   int readNumber;
 } Pair;
 
@@ -114,6 +114,7 @@ typedef struct
 
 extern long long			verificationCnt;
 extern long long			mappingCnt;
+extern long long			skippedCandidateCnt;
 extern long long			mappedSeqCnt;
 extern long long			completedSeqCnt;
 
@@ -173,9 +174,9 @@ int verifySingleEndEditDistanceExtension(int refIndex, char *lSeq, int lSeqLengt
 
 // for fastHASH 
 int compareEntrySize (const void *a, const void *b);											// fastHASH()
-void mapSingleEndSeq(unsigned int *l1, int s1, int readNumber, int readSegment, int direction,	// fastHASH()
+void mapSingleEndSeq(unsigned int *l1, int s1, int readNumber, int readOffset, int direction,	// fastHASH()
                      int index, key_struct* keys_input, int potential_key_number); 				// fastHASH()
-void mapPairEndSeqList(unsigned int *l1, int s1, int readNumber, int readSegment, int direction,// fastHASH()
+void mapPairEndSeqList(unsigned int *l1, int s1, int readNumber, int readOffset, int direction,// fastHASH()
                        int index, key_struct* keys_input, int potential_key_number); 			// fastHASH(
 void mapPairedEndSeq();
 void outputPairedEnd();
@@ -53,6 +53,7 @@
 #include "HashTable.h"
 
 #define CHARCODE(a) (a=='A' ? 0 : (a=='C' ? 1 : (a=='G' ? 2 : (a=='T' ? 3 : 4))))
+#define READ_SLAB_SIZE		(1 << 22)		// Bytes of a block of read payloads
 
 FILE *_r_fp1;
 FILE *_r_fp2;
@@ -61,6 +62,11 @@ gzFile _r_gzfp2;
 Read *_r_seq;
 int _r_seqCnt;
 int *_r_samplingLocs;
+char **_r_slabs = NULL;					// Blocks holding the payloads of the reads
+int _r_slabCnt = 0;
+int _r_slabCapacity = 0;
+int _r_slabUsed = READ_SLAB_SIZE;			// Bytes used in the last block
+const char _r_noQual[SEQ_MAX_LENGTH+1] = "*";		// Quality of every fasta read, never written
 
 /**********************************************/
 char *(*readFirstSeq)(char *);
@@ -88,6 +94,85 @@ char *readSecondSeqGZ( char *seq )
   return gzgets(_r_gzfp2, seq, SEQ_MAX_LENGTH);
 }
 /**********************************************/
+// Payloads are carved in order from large blocks, so millions of reads take a
+// few allocations and consecutive reads sit next to each other
+char *getReadMem(int size)
+{
+  char **tmp;
+
+  if (_r_slabUsed + size > READ_SLAB_SIZE)
+    {
+      if (_r_slabCnt == _r_slabCapacity)
+	{
+	  tmp = getMem(sizeof(char *) * (2*_r_slabCapacity + 16));
+	  if (_r_slabs != NULL)
+	    {
+	      memcpy(tmp, _r_slabs, sizeof(char *) * _r_slabCnt);
+	      freeMem(_r_slabs, sizeof(char *) * _r_slabCapacity);
+	    }
+	  _r_slabs = tmp;
+	  _r_slabCapacity = 2*_r_slabCapacity + 16;
+	}
+      _r_slabs[_r_slabCnt++] = getMem(READ_SLAB_SIZE);
+      _r_slabUsed = 0;
+    }
+  _r_slabUsed += size;
+  return _r_slabs[_r_slabCnt-1] + _r_slabUsed - size;
+}
+/**********************************************/
+// Lays out hits, seq, rseq, qual and name of a read of length len in one piece;
+// fasta reads have no quality of their own and share _r_noQual
+void allocRead(Read *read, int len, int nameLen, int fastq)
+{
+  read->hits = getReadMem(1 + 2*(len+1) + ((fastq) ? len+1 : 0) + nameLen+1);
+  read->seq = read->hits + 1;
+  read->rseq = read->seq + len+1;
+  if (fastq)
+    {
+      read->qual = read->rseq + len+1;
+      read->name = read->qual + len+1;
+    }
+  else
+    {
+      read->qual = (char *)_r_noQual;
+      read->name = read->rseq + len+1;
+    }
+}
+/**********************************************/
+// Opens a read file; "-" is the standard input, so reads can come from a pipe
+FILE *openReadFile(char *fileName)
+{
+  if (strcmp(fileName, "-") == 0)
+    return stdin;
+  return fileOpen(fileName, "r");
+}
+/**********************************************/
+gzFile openReadFileGZ(char *fileName)
+{
+  gzFile gzfp;
+
+  if (strcmp(fileName, "-") != 0)
+    return fileOpenGZ(fileName, "r");
+
+  gzfp = gzdopen(fileno(stdin), "r");
+  if (gzfp == NULL)
+    {
+      fprintf(stderr, "Error: Cannot Open the standard input\n");
+      exit(0);
+    }
+  return gzfp;
+}
+/**********************************************/
+// Next line of a record; the input was cut if it is missing
+void readRecordLine(char *(*readSeq)(char *), char *line, int readCnt)
+{
+  if (readSeq(line) == NULL)
+    {
+      fprintf(stderr, "Input FASTQ file seems to be truncated after %d reads. Exiting.\n", readCnt);
+      exit (1);
+    }
+}
+/**********************************************/
 int toCompareRead(const void * elem1, const void * elem2)
 {
   return strcmp(((Read *)elem1)->seq, ((Read *)elem2)->seq);	
@@ -113,11 +198,12 @@ int readAllReads(char *fileName1,
   char qual2[SEQ_MAX_LENGTH];
 
   char dummy[SEQ_MAX_LENGTH];
-  char ch;
+  int ch;
   int err1, err2;
   int nCnt;
   int discarded = 0;
   int seqCnt = 0;
+  int readCnt = 0;
   int maxCnt = 0;
   int i;
   Read *list = NULL;
@@ -126,7 +212,7 @@ int readAllReads(char *fileName1,
 
   if (!compressed)
     {
-      _r_fp1 = fileOpen( fileName1, "r");
+      _r_fp1 = openReadFile(fileName1);
 
       if (_r_fp1 == NULL)
 	{
@@ -134,10 +220,11 @@ int readAllReads(char *fileName1,
 	}
 
       ch = fgetc(_r_fp1);
+      ungetc(ch, _r_fp1);
 
       if ( pairedEnd && fileName2 != NULL )
 	{
-	  _r_fp2 = fileOpen ( fileName2, "r" );
+	  _r_fp2 = openReadFile(fileName2);
 	  if (_r_fp2 == NULL)
 	    {
 	      return 0;
@@ -154,7 +241,7 @@ int readAllReads(char *fileName1,
   else
     {
 
-      _r_gzfp1 = fileOpenGZ (fileName1, "r");
+      _r_gzfp1 = openReadFileGZ(fileName1);
 
       if (_r_gzfp1 == NULL)
 	{
@@ -162,10 +249,11 @@ int readAllReads(char *fileName1,
 	}
 
       ch = gzgetc(_r_gzfp1);
+      gzungetc(ch, _r_gzfp1);
 
       if ( pairedEnd && fileName2 != NULL )
 	{
-	  _r_gzfp2 = fileOpenGZ ( fileName2, "r" );
+	  _r_gzfp2 = openReadFileGZ(fileName2);
 	  if (_r_gzfp2 == NULL)
 	    {
 	      return 0;
@@ -185,46 +273,12 @@ int readAllReads(char *fileName1,
   else
     *fastq = 1;
 
-  // Counting the number of lines in the file
-  while (readFirstSeq(dummy)) maxCnt++;
-
-  if (!compressed)
-    {
-      rewind(_r_fp1);
-    }
-  else
-    {
-      gzrewind(_r_gzfp1);
-    }
-
-  // Calculating the Maximum # of sequences
-  if (*fastq)
-    {
-      if (maxCnt % 4 != 0){
-        fprintf(stderr, "Input FASTQ file seems to be truncated. Number of lines: %d. Exiting.\n", maxCnt);
-	exit (1);
-      }
-      maxCnt /= 4;
-    }
-  else
-    {
-      if (maxCnt % 2 != 0){
-        fprintf(stderr, "Input FASTQ file seems to be truncated. Number of lines: %d. Exiting.\n", maxCnt);
-	exit (1);
-      }
-      maxCnt /= 2;
-    }
-
-  if (pairedEnd && fileName2 != NULL )
-    maxCnt *= 2;
-
-  list = getMem(sizeof(Read)*maxCnt);
-
+  // The reads are stored in one pass, so the input can be a pipe
   while( readFirstSeq(name1) )
     {
       err1 = 0;
       err2 = 0;
-      readFirstSeq(seq1);
+      readRecordLine(readFirstSeq, seq1, readCnt);
       
       
       name1[strlen(name1)-1] = '\0';
@@ -255,8 +309,8 @@ int readAllReads(char *fileName1,
       
       if ( *fastq )
 	{
-	  readFirstSeq(dummy);
-	  readFirstSeq(qual1);
+	  readRecordLine(readFirstSeq, dummy, readCnt);
+	  readRecordLine(readFirstSeq, qual1, readCnt);
 	  qual1[strlen(qual1)-1] = '\0';
 	}
       else
@@ -297,8 +351,8 @@ int readAllReads(char *fileName1,
       // Reading the second seq of pair-ends
       if (pairedEnd)
 	{
-	  readSecondSeq(name2);
-	  readSecondSeq(seq2);
+	  readRecordLine(readSecondSeq, name2, readCnt);
+	  readRecordLine(readSecondSeq, seq2, readCnt);
 	  name2[strlen(name2)-1] = '\0';
 	  for (i=0; i<strlen(name2);i++)
 	    {
@@ -312,8 +366,8 @@ int readAllReads(char *fileName1,
 	  
 	  if ( *fastq )
 	    {
-	      readSecondSeq(dummy);
-	      readSecondSeq(qual2);
+	      readRecordLine(readSecondSeq, dummy, readCnt);
+	      readRecordLine(readSecondSeq, qual2, readCnt);
 
 	      qual2[strlen(qual2)-1] = '\0';
 	    }
@@ -372,17 +426,26 @@ int readAllReads(char *fileName1,
 			
 
 
+	}
+      readCnt++;
+
+      // Room for a pair; the list grows geometrically
+      if (seqCnt + 2 > maxCnt)
+	{
+	  Read *tmp = getMem(sizeof(Read) * (2*maxCnt + 1024));
+	  if (list != NULL)
+	    {
+	      memcpy(tmp, list, sizeof(Read) * seqCnt);
+	      freeMem(list, sizeof(Read) * maxCnt);
+	    }
+	  list = tmp;
+	  maxCnt = 2*maxCnt + 1024;
 	}
 
       if (!pairedEnd && !err1)
 	{
 	  int _mtmp = strlen(seq1);
-	  list[seqCnt].hits = getMem (1+3*_mtmp+3+strlen(name1)+1);
-	  list[seqCnt].seq  = list[seqCnt].hits + 1;
-	  list[seqCnt].rseq = list[seqCnt].seq + _mtmp+1;
-	  list[seqCnt].qual = list[seqCnt].rseq + _mtmp+1;
-	  list[seqCnt].name = list[seqCnt].qual + _mtmp+1;
-                        
+	  allocRead(&list[seqCnt], _mtmp, strlen(name1), *fastq);
 
 	  list[seqCnt].readNumber = seqCnt;			
 
@@ -396,10 +459,13 @@ int readAllReads(char *fileName1,
 	    {
 	      list[seqCnt].seq[i] = seq1[i];
 	      list[seqCnt].rseq[i] = rseq1[i] ;
-	      list[seqCnt].qual[i] = qual1[i];
+	      if (*fastq)
+		list[seqCnt].qual[i] = qual1[i];
 	    }
 	  
-	  list[seqCnt].rseq[_mtmp]=list[seqCnt].qual[_mtmp]='\0';	
+	  list[seqCnt].rseq[_mtmp]='\0';
+	  if (*fastq)
+	    list[seqCnt].qual[_mtmp]='\0';
 	
 	  sprintf(list[seqCnt].name,"%s%c", ((char*)name1)+1,'\0');
 
@@ -418,11 +484,7 @@ int readAllReads(char *fileName1,
 		
 	  //first seq
 	  int _mtmp = strlen(seq1);
-	  list[seqCnt].hits = getMem (1+3*_mtmp+3+tmplen+1);
-	  list[seqCnt].seq = list[seqCnt].hits + 1;
-	  list[seqCnt].rseq = list[seqCnt].seq + _mtmp+1;
-	  list[seqCnt].qual = list[seqCnt].rseq + _mtmp+1;
-	  list[seqCnt].name = list[seqCnt].qual + _mtmp+1;
+	  allocRead(&list[seqCnt], _mtmp, tmplen, *fastq);
 
 	  list[seqCnt].readNumber = seqCnt;
 
@@ -436,23 +498,22 @@ int readAllReads(char *fileName1,
 	    {
 	      list[seqCnt].seq[i] = seq1[i];
 	      list[seqCnt].rseq[i] = rseq1[i] ;
-	      list[seqCnt].qual[i] = qual1[i];
+	      if (*fastq)
+		list[seqCnt].qual[i] = qual1[i];
 	    }
 
 
 	  name1[tmplen]='\0';
-	  list[seqCnt].rseq[_mtmp]=list[seqCnt].qual[_mtmp]='\0';
+	  list[seqCnt].rseq[_mtmp]='\0';
+	  if (*fastq)
+	    list[seqCnt].qual[_mtmp]='\0';
 
 	  sprintf(list[seqCnt].name,"%s%c", ((char*)name1)+1,'\0');
 
 	  seqCnt++;
 
 	  //second seq
-	  list[seqCnt].hits = getMem (1+3*_mtmp+3+tmplen+1);
-	  list[seqCnt].seq = list[seqCnt].hits + 1;
-	  list[seqCnt].rseq = list[seqCnt].seq + _mtmp+1;
-	  list[seqCnt].qual = list[seqCnt].rseq + _mtmp+1;
-	  list[seqCnt].name = list[seqCnt].qual + _mtmp+1;
+	  allocRead(&list[seqCnt], _mtmp, tmplen, *fastq);
 
 	  list[seqCnt].readNumber = seqCnt;
 
@@ -465,12 +526,15 @@ int readAllReads(char *fileName1,
 	    {
 	      list[seqCnt].seq[i] = seq2[i];
 	      list[seqCnt].rseq[i] = rseq2[i] ;
-	      list[seqCnt].qual[i] = qual2[i];
+	      if (*fastq)
+		list[seqCnt].qual[i] = qual2[i];
 	    }
 
 
 	  name2[tmplen]='\0';
-	  list[seqCnt].rseq[_mtmp]=list[seqCnt].qual[_mtmp]='\0';
+	  list[seqCnt].rseq[_mtmp]='\0';
+	  if (*fastq)
+	    list[seqCnt].qual[_mtmp]='\0';
 
 	  sprintf(list[seqCnt].name,"%s%c", ((char*)name2)+1,'\0');
 
@@ -486,6 +550,12 @@ int readAllReads(char *fileName1,
   if (seqCnt > 0)
     {
       SEQ_LENGTH = strlen(list[0].seq);
+
+      // Drops the slack of the last growth
+      Read *tmp = getMem(sizeof(Read) * seqCnt);
+      memcpy(tmp, list, sizeof(Read) * seqCnt);
+      freeMem(list, sizeof(Read) * maxCnt);
+      list = tmp;
     }
   else
     {
@@ -512,7 +582,8 @@ int readAllReads(char *fileName1,
 	}
     }
 
-  adjustQual(list, seqCnt);
+  if (*fastq)
+    adjustQual(list, seqCnt);
 
   *seqList = list;
   *seqListSize = seqCnt;
@@ -586,11 +657,12 @@ void finalizeReads(char *fileName)
   if (pairedEndMode)
     _r_seqCnt *= 2;
 
-  for (i = 0; i < _r_seqCnt; i++)
-    {
-      freeMem(_r_seq[i].hits,0);
-    }
-
+  for (i = 0; i < _r_slabCnt; i++)
+    freeMem(_r_slabs[i], READ_SLAB_SIZE);
+  freeMem(_r_slabs, sizeof(char *) * _r_slabCapacity);
+  _r_slabs = NULL;
+  _r_slabCnt = _r_slabCapacity = 0;
+  _r_slabUsed = READ_SLAB_SIZE;
 
   freeMem(_r_seq,0);
   freeMem(_r_samplingLocs,0);
@@ -54,6 +54,7 @@ typedef struct
   unsigned int* key_entry;
   int key_entry_size;
   int key_number;
+  int key_offset;		// Offset of the key in the read
   int order;  
 } key_struct; 
 
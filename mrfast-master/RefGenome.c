@@ -47,68 +47,424 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <emmintrin.h>
 #include "Common.h"
 #include "RefGenome.h"
 
+#define RG_BUFFER_SIZE		(1 << 20)		// Bytes of the fasta file read at once
+#define RG_BGZF_BLOCKS		64			// BGZF blocks decompressed per batch
+#define RG_BGZF_BLOCK_SIZE	65536			// Largest BGZF block, compressed or not
+
+// Batch of BGZF blocks: they are read from the file in order, then inflated
+// by the decompression threads into consecutive parts of data
+typedef struct
+{
+  unsigned char	*in;
+  char		*data;
+  int		blockCnt;				// 0 at the end of the file
+  int		inOffset[RG_BGZF_BLOCKS+1];
+  int		outOffset[RG_BGZF_BLOCKS+1];
+} RefGenomeBatch;
+
+typedef struct
+{
+  RefGenomeBatch *batch;
+  int		first;					// Blocks first, first+step, ...
+  int		step;
+} RefGenomeInflater;
+
+// Contig of a samtools .fai index
+typedef struct
+{
+  char		name[CONTIG_NAME_SIZE];
+  long long	offset;					// Byte of the first base
+  int		length;
+  int		lineBases;
+  int		lineWidth;				// Bytes of a line, line end included
+} RefGenomeContig;
+
 FILE *_rg_fp;
+gzFile _rg_gz = NULL;					// Gzip fasta that is not BGZF
+int _rg_bgzf = 0;
+RefGenomeBatch _rg_batches[2];				// Batch being parsed and the next one
+int _rg_batch;
+int _rg_eof;
+int _rg_bgzfEnd = 0;					// The last block read was the empty EOF block
+pthread_t _rg_thread;
+int _rg_prefetching = 0;
+char *_rg_block;					// Block of a plain or gzip fasta
+FILE *_rg_faiFp = NULL;					// Fasta file reached through the .fai
+RefGenomeContig *_rg_contigs;
+int _rg_contigCnt;
+int _rg_contigCapacity;
+int _rg_lastContig;
+char *_rg_range;
+int _rg_rangeSize = 0;
+char *_rg_rangeRaw;
+int _rg_rangeRawSize = 0;
 char *_rg_gen;
 char *_rg_name;
 int _rg_offset;
 int _rg_contGen; 
+char *_rg_buf;						// Bytes of the fasta file being parsed
+int _rg_pos;
+int _rg_end;
+
+/**********************************************/
+// 1 if h is a gzip header with the BC extra field of BGZF
+int isBGZFHeader(unsigned char *h)
+{
+  return (h[0] == 31 && h[1] == 139 && h[2] == 8 && (h[3] & 4) && h[10] == 6 && h[11] == 0
+	  && h[12] == 'B' && h[13] == 'C' && h[14] == 2 && h[15] == 0);
+}
+/**********************************************/
+void readRefGenomeBatch(RefGenomeBatch *b)
+{
+  unsigned char *h;
+  unsigned int len, size;
+  size_t n;
+
+  b->blockCnt = 0;
+  while (b->blockCnt < RG_BGZF_BLOCKS)
+    {
+      h = b->in + b->inOffset[b->blockCnt];
+      if ((n = fread(h, 1, 18, _rg_fp)) == 0 && !ferror(_rg_fp))
+	{
+	  // A BGZF file ends with an empty block; without it the file was cut
+	  if (!_rg_bgzfEnd)
+	    {
+	      fprintf(stderr, "Error: The BGZF reference genome is truncated.\n");
+	      exit(0);
+	    }
+	  break;
+	}
+      if (n != 18)
+	{
+	  fprintf(stderr, "Error: Corrupted BGZF block in the reference genome.\n");
+	  exit(0);
+	}
+
+      len = (h[16] | (h[17] << 8)) + 1;
+      if (!isBGZFHeader(h) || len < 26 || fread(h + 18, 1, len - 18, _rg_fp) != len - 18)
+	{
+	  fprintf(stderr, "Error: Corrupted BGZF block in the reference genome.\n");
+	  exit(0);
+	}
+
+      size = h[len-4] | (h[len-3] << 8) | (h[len-2] << 16) | ((unsigned int)h[len-1] << 24);
+      if (size > RG_BGZF_BLOCK_SIZE)
+	{
+	  fprintf(stderr, "Error: Corrupted BGZF block in the reference genome.\n");
+	  exit(0);
+	}
+      b->inOffset[b->blockCnt+1] = b->inOffset[b->blockCnt] + len;
+      b->outOffset[b->blockCnt+1] = b->outOffset[b->blockCnt] + size;
+      b->blockCnt++;
+      _rg_bgzfEnd = (size == 0);
+    }
+}
+/**********************************************/
+void *inflateRefGenomeBlocks(void *arg)
+{
+  RefGenomeInflater *w = arg;
+  RefGenomeBatch *b = w->batch;
+  unsigned char *in, *out;
+  unsigned int len, size, crc;
+  z_stream z;
+  int i, ok;
+
+  for (i=w->first; i < b->blockCnt; i += w->step)
+    {
+      in = b->in + b->inOffset[i];
+      len = b->inOffset[i+1] - b->inOffset[i];
+      out = (unsigned char *)b->data + b->outOffset[i];
+      size = b->outOffset[i+1] - b->outOffset[i];
+      if (size == 0)
+	continue;
+
+      memset(&z, 0, sizeof(z));
+      if (inflateInit2(&z, -15) != Z_OK)
+	ok = 0;
+      else
+	{
+	  z.next_in = in + 18;
+	  z.avail_in = len - 26;
+	  z.next_out = out;
+	  z.avail_out = size;
+	  crc = in[len-8] | (in[len-7] << 8) | (in[len-6] << 16) | ((unsigned int)in[len-5] << 24);
+	  ok = (inflate(&z, Z_FINISH) == Z_STREAM_END && z.avail_out == 0 && crc32(0, out, size) == crc);
+	  inflateEnd(&z);
+	}
+
+      if (!ok)
+	{
+	  fprintf(stderr, "Error: Corrupted BGZF block in the reference genome.\n");
+	  exit(0);
+	}
+    }
+  return NULL;
+}
+/**********************************************/
+// Reads the next batch of BGZF blocks and inflates it on threadCount threads
+void *fillRefGenomeBatch(void *arg)
+{
+  RefGenomeBatch	*b = arg;
+  RefGenomeInflater	w[threadCount];
+  pthread_t		t[threadCount];
+  int i;
+
+  readRefGenomeBatch(b);
+  for (i=0; i < threadCount; i++)
+    {
+      w[i].batch = b;
+      w[i].first = i;
+      w[i].step = threadCount;
+    }
+
+  for (i=1; i < threadCount; i++)
+    {
+      if (pthread_create(&t[i], NULL, inflateRefGenomeBlocks, &w[i]) != 0)
+	{
+	  fprintf(stderr, "Error: Cannot create decompression thread.\n");
+	  exit(0);
+	}
+    }
+  inflateRefGenomeBlocks(&w[0]);
+  for (i=1; i < threadCount; i++)
+    pthread_join(t[i], NULL);
+  return NULL;
+}
+/**********************************************/
+// Fills the batch after the current one while the current one is parsed
+void startRefGenomeBatch()
+{
+  RefGenomeBatch *b = &_rg_batches[1 - _rg_batch];
+
+  if (pthread_create(&_rg_thread, NULL, fillRefGenomeBatch, b) == 0)
+    _rg_prefetching = 1;
+  else
+    fillRefGenomeBatch(b);
+}
+/**********************************************/
+void waitRefGenomeBatch()
+{
+  if (_rg_prefetching)
+    pthread_join(_rg_thread, NULL);
+  _rg_prefetching = 0;
+}
+/**********************************************/
+// Next bytes of the fasta file in _rg_buf, 0 at its end
+int readRefGenomeBlock()
+{
+  RefGenomeBatch *b;
+  int size = 0;
+  int err = Z_OK;
+
+  if (!_rg_bgzf)
+    {
+      _rg_buf = _rg_block;
+      if (_rg_gz != NULL)
+	{
+	  // A cut gzip stream ends in an error, not in a short genome
+	  size = gzread(_rg_gz, _rg_block, RG_BUFFER_SIZE);
+	  if (size <= 0)
+	    gzerror(_rg_gz, &err);
+	  if (size < 0 || (err != Z_OK && err != Z_STREAM_END))
+	    {
+	      fprintf(stderr, "Error: Cannot decompress the reference genome: %s\n", gzerror(_rg_gz, &err));
+	      exit(0);
+	    }
+	  return size;
+	}
+      size = fread(_rg_block, 1, RG_BUFFER_SIZE, _rg_fp);
+      if (size == 0 && ferror(_rg_fp))
+	{
+	  fprintf(stderr, "Error: Cannot read the reference genome.\n");
+	  exit(0);
+	}
+      return size;
+    }
+
+  while (size == 0 && !_rg_eof)
+    {
+      waitRefGenomeBatch();
+      _rg_batch = 1 - _rg_batch;
+      b = &_rg_batches[_rg_batch];
+      if (b->blockCnt == 0)
+	_rg_eof = 1;
+      else
+	startRefGenomeBatch();
+      _rg_buf = b->data;
+      size = b->outOffset[b->blockCnt];
+    }
+  return size;
+}
+/**********************************************/
+// Next byte of the fasta file, EOF at its end
+static inline int getRefGenomeChar()
+{
+  if (_rg_pos == _rg_end)
+    {
+      _rg_end = readRefGenomeBlock();
+      _rg_pos = 0;
+      if (_rg_end <= 0)
+	{
+	  _rg_end = 0;
+	  return EOF;
+	}
+    }
+  return (unsigned char)_rg_buf[_rg_pos++];
+}
+/**********************************************/
+// Rest of the header line, cut at the first space. NULL at the end of the file.
+char *readRefGenomeName()
+{
+  int ch, len = 0, cut = 0;
 
+  while ((ch = getRefGenomeChar()) != EOF)
+    {
+      if (ch == ' ')
+	cut = 1;
+      if (!cut && len < CONTIG_NAME_SIZE - 1)
+	_rg_name[len++] = ch;
+      if (ch == '\n')
+	break;
+    }
+  _rg_name[len] = '\0';
+  return (len > 0 || ch != EOF) ? _rg_name : NULL;
+}
 /**********************************************/
+// Plain fasta files are read in blocks, gzip ones through zlib. BGZF blocks
+// are inflated in batches ahead of the parser on --threads threads.
 int initLoadingRefGenome(char *fileName)
 {
-  char ch;
+  unsigned char h[18];
+  int i;
+
   _rg_fp = fileOpen (fileName, "r");
-  if (fscanf(_rg_fp, "%c", &ch))
+  _rg_block = getMem(RG_BUFFER_SIZE);
+  _rg_pos = _rg_end = 0;
+  _rg_gz = NULL;
+  _rg_bgzf = 0;
+
+  memset(h, 0, sizeof(h));
+  if (fread(h, 1, sizeof(h), _rg_fp) > 0)
+    rewind(_rg_fp);
+  if (isBGZFHeader(h))
     {
-      if (ch == '>')
+      _rg_bgzf = 1;
+      _rg_eof = 0;
+      _rg_bgzfEnd = 0;
+      for (i=0; i<2; i++)
 	{
-	  _rg_contGen = 0;
-	  _rg_offset = 0;
-	  _rg_gen = getMem(CONTIG_MAX_SIZE);
-	  _rg_name = getMem(CONTIG_NAME_SIZE);
-	  return 1;
+	  _rg_batches[i].in = getMem(RG_BGZF_BLOCKS * RG_BGZF_BLOCK_SIZE);
+	  _rg_batches[i].data = getMem(RG_BGZF_BLOCKS * RG_BGZF_BLOCK_SIZE);
+	  _rg_batches[i].blockCnt = 0;
+	  _rg_batches[i].inOffset[0] = _rg_batches[i].outOffset[0] = 0;
 	}
+      _rg_batch = 1;
+      startRefGenomeBatch();
+    }
+  else if (h[0] == 31 && h[1] == 139)
+    {
+      fclose(_rg_fp);
+      _rg_fp = NULL;
+      _rg_gz = fileOpenGZ(fileName, "r");
+    }
+
+  if (getRefGenomeChar() == '>')
+    {
+      _rg_contGen = 0;
+      _rg_offset = 0;
+      // Slack for the 16 byte stores of loadRefGenome
+      _rg_gen = getMem(CONTIG_MAX_SIZE + 16);
+      _rg_name = getMem(CONTIG_NAME_SIZE);
+      return 1;
     }
   return 0;
 }
 /**********************************************/
 void finalizeLoadingRefGenome()
 {
-  freeMem(_rg_gen, CONTIG_MAX_SIZE);
+  freeMem(_rg_gen, CONTIG_MAX_SIZE + 16);
   freeMem(_rg_name, CONTIG_NAME_SIZE); 
-  fclose(_rg_fp);
+  freeMem(_rg_block, RG_BUFFER_SIZE);
+
+  if (_rg_bgzf)
+    {
+      int i;
+
+      waitRefGenomeBatch();
+      for (i=0; i<2; i++)
+	{
+	  freeMem(_rg_batches[i].in, RG_BGZF_BLOCKS * RG_BGZF_BLOCK_SIZE);
+	  freeMem(_rg_batches[i].data, RG_BGZF_BLOCKS * RG_BGZF_BLOCK_SIZE);
+	}
+      _rg_bgzf = 0;
+    }
+
+  if (_rg_gz != NULL)
+    gzclose(_rg_gz);
+  else
+    fclose(_rg_fp);
+  _rg_gz = NULL;
+}
+/**********************************************/
+// Copies the bases of the buffer to _rg_gen 16 bytes at a time: the block is
+// uppercased and stored whole, and only the bytes before its first
+// whitespace or '>' are kept. Stops at such a byte, near the end of the
+// buffer, or when the chunk could fill up within the next block; the caller
+// handles those byte by byte.
+static inline void copyRefGenomeBlocks(int *size, int *actualSize)
+{
+  const __m128i lower = _mm_set1_epi8('a' - 1), upper = _mm_set1_epi8('z' + 1);
+  const __m128i tab = _mm_set1_epi8('\t' - 1), cr = _mm_set1_epi8('\r' + 1);
+  const __m128i space = _mm_set1_epi8(' '), gt = _mm_set1_epi8('>');
+  const __m128i n = _mm_set1_epi8('N'), caseBit = _mm_set1_epi8(0x20);
+  __m128i x, special;
+  unsigned int mask, keep;
+  int room;
+
+  while (_rg_end - _rg_pos >= 16)
+    {
+      room = CONTIG_SIZE - *actualSize;
+      if (CONTIG_MAX_SIZE - *size < room)
+	room = CONTIG_MAX_SIZE - *size;
+      if (room < 16)
+	return;
+
+      x = _mm_loadu_si128((__m128i *)(_rg_buf + _rg_pos));
+      x = _mm_sub_epi8(x, _mm_and_si128(caseBit, _mm_and_si128(_mm_cmpgt_epi8(x, lower), _mm_cmplt_epi8(x, upper))));
+      special = _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi8(x, tab), _mm_cmplt_epi8(x, cr)),
+			     _mm_or_si128(_mm_cmpeq_epi8(x, space), _mm_cmpeq_epi8(x, gt)));
+      mask = _mm_movemask_epi8(special);
+      keep = (mask) ? __builtin_ctz(mask) : 16;
+
+      _mm_storeu_si128((__m128i *)(_rg_gen + *size), x);
+      *size += keep;
+      *actualSize += keep - __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(x, n)) & ((1U << keep) - 1));
+      _rg_pos += keep;
+      if (keep < 16)
+	return;
+    }
 }
 /**********************************************/
 int loadRefGenome(char **refGen, char **refGenName, int *refGenOff)
 {
-  char ch;
+  int ch;
   int i;
   int returnVal = 0;
   int actualSize=0;
   int size;
-  char *tmp;
 	
   // New Contig 
   if (!_rg_contGen)
     {
       size = 0;
-      tmp = fgets(_rg_name, SEQ_MAX_LENGTH, _rg_fp);
-
-      if (tmp==NULL)
+      if (readRefGenomeName()==NULL)
 	fprintf(stderr, "Error reading the contig.\n");
-      
-      int k;
-      for (k=0; k<strlen(_rg_name);k++)
-	{
-	  if (_rg_name[k] == ' ')
-	    {
-	      _rg_name[k]='\0';
-	      break;
-	    }
-	}
     }
   else
     {
@@ -122,8 +478,18 @@ int loadRefGenome(char **refGen, char **refGenName, int *refGenOff)
 	}
       size = CONTIG_OVERLAP;
     }
-  while( fscanf(_rg_fp, "%c", &ch) > 0 )
+  while (1)
     {
+      copyRefGenomeBlocks(&size, &actualSize);
+      if (actualSize == CONTIG_SIZE || size == CONTIG_MAX_SIZE)
+	{
+	  _rg_contGen = 1;
+	  returnVal=1;
+	  break;
+	}
+
+      if ((ch = getRefGenomeChar()) == EOF)
+	break;
       if (ch == '>')
 	{
 	  _rg_contGen = 0;
@@ -172,3 +538,143 @@ int loadRefGenome(char **refGen, char **refGenName, int *refGenOff)
   return returnVal;
 }
 /**********************************************/
+// Random access to the contigs of an uncompressed fasta file through the
+// offsets of its samtools .fai index
+int initRefGenomeAccess(char *fileName)
+{
+  char faiName[FILE_NAME_LENGTH];
+  char line[CONTIG_NAME_SIZE + 256];
+  unsigned char h[2] = {0, 0};
+  RefGenomeContig *c;
+  FILE *fp;
+  char *p;
+  int n;
+
+  snprintf(faiName, FILE_NAME_LENGTH, "%s.fai", fileName);
+  fp = fopen(faiName, "r");
+  if (fp == NULL)
+    return 0;
+
+  _rg_faiFp = fopen(fileName, "r");
+  if (_rg_faiFp == NULL || fread(h, 1, 2, _rg_faiFp) != 2 || (h[0] == 31 && h[1] == 139))
+    {
+      // gzip and BGZF files cannot be reached through the .fai offsets
+      if (_rg_faiFp != NULL)
+	fclose(_rg_faiFp);
+      _rg_faiFp = NULL;
+      fclose(fp);
+      return 0;
+    }
+
+  _rg_contigCnt = 0;
+  _rg_contigCapacity = 64;
+  _rg_contigs = getMem(_rg_contigCapacity * sizeof(RefGenomeContig));
+  while (fgets(line, sizeof(line), fp) != NULL)
+    {
+      if ((p = strchr(line, '\t')) == NULL)
+	continue;
+      *p++ = '\0';
+
+      if (_rg_contigCnt == _rg_contigCapacity)
+	{
+	  c = getMem(2 * _rg_contigCapacity * sizeof(RefGenomeContig));
+	  memcpy(c, _rg_contigs, _rg_contigCapacity * sizeof(RefGenomeContig));
+	  freeMem(_rg_contigs, _rg_contigCapacity * sizeof(RefGenomeContig));
+	  _rg_contigs = c;
+	  _rg_contigCapacity *= 2;
+	}
+
+      c = &_rg_contigs[_rg_contigCnt];
+      n = sscanf(p, "%d %lld %d %d", &c->length, &c->offset, &c->lineBases, &c->lineWidth);
+      if (n != 4 || c->length < 0 || c->lineBases <= 0 || c->lineWidth < c->lineBases)
+	{
+	  fprintf(stderr, "Error: Corrupted line for %s in %s\n", line, faiName);
+	  exit(0);
+	}
+      // Names are cut like the contig names of loadRefGenome
+      strncpy(c->name, line, CONTIG_NAME_SIZE - 1);
+      c->name[CONTIG_NAME_SIZE - 1] = '\0';
+      _rg_contigCnt++;
+    }
+  fclose(fp);
+
+  _rg_lastContig = 0;
+  _rg_rangeSize = 0;
+  return 1;
+}
+/**********************************************/
+void finalizeRefGenomeAccess()
+{
+  if (_rg_faiFp == NULL)
+    return;
+  fclose(_rg_faiFp);
+  _rg_faiFp = NULL;
+  freeMem(_rg_contigs, _rg_contigCapacity * sizeof(RefGenomeContig));
+  if (_rg_rangeSize)
+    {
+      freeMem(_rg_range, _rg_rangeSize);
+      freeMem(_rg_rangeRaw, _rg_rangeRawSize);
+    }
+  _rg_rangeSize = _rg_rangeRawSize = 0;
+}
+/**********************************************/
+// Index of the contig called name, -1 if the .fai does not list it
+int getRefGenomeContig(char *name)
+{
+  int i;
+
+  if (_rg_lastContig < _rg_contigCnt && strcmp(_rg_contigs[_rg_lastContig].name, name) == 0)
+    return _rg_lastContig;
+  for (i=0; i < _rg_contigCnt; i++)
+    if (strcmp(_rg_contigs[i].name, name) == 0)
+      return (_rg_lastContig = i);
+  return -1;
+}
+/**********************************************/
+// The length bases of contig from the 1-based start, upper case; bases out of
+// the contig read as N. The buffer is reused by the next call.
+char *getRefGenomeRange(int contig, int start, int length)
+{
+  RefGenomeContig *c = &_rg_contigs[contig];
+  long long first, last;
+  int from, to, i, n, rawSize;
+
+  if (length + 1 > _rg_rangeSize)
+    {
+      if (_rg_rangeSize)
+	freeMem(_rg_range, _rg_rangeSize);
+      _rg_rangeSize = length + 1;
+      _rg_range = getMem(_rg_rangeSize);
+    }
+  memset(_rg_range, 'N', length);
+  _rg_range[length] = '\0';
+
+  from = (start > 1) ? start - 1 : 0;
+  to = (start - 1 + length < c->length) ? start - 1 + length : c->length;
+  if (from >= to)
+    return _rg_range;
+
+  // Bytes between the first and the last base, line ends included
+  first = c->offset + (long long)(from / c->lineBases) * c->lineWidth + from % c->lineBases;
+  last = c->offset + (long long)((to-1) / c->lineBases) * c->lineWidth + (to-1) % c->lineBases;
+  rawSize = last - first + 1;
+  if (rawSize > _rg_rangeRawSize)
+    {
+      if (_rg_rangeRawSize)
+	freeMem(_rg_rangeRaw, _rg_rangeRawSize);
+      _rg_rangeRawSize = rawSize;
+      _rg_rangeRaw = getMem(_rg_rangeRawSize);
+    }
+
+  if (fseeko(_rg_faiFp, first, SEEK_SET) != 0 || fread(_rg_rangeRaw, 1, rawSize, _rg_faiFp) != rawSize)
+    {
+      fprintf(stderr, "Error: Cannot read %s:%d-%d from the reference genome.\n", c->name, from+1, to);
+      exit(0);
+    }
+
+  n = from - (start - 1);
+  for (i=0; i < rawSize; i++)
+    if (!isspace(_rg_rangeRaw[i]))
+      _rg_range[n++] = toupper(_rg_rangeRaw[i]);
+  return _rg_range;
+}
@@ -49,4 +49,8 @@
 int		initLoadingRefGenome(char *fileName);
 void            finalizeLoadingRefGenome();
 int		loadRefGenome(char **refGen, char **refGenName, int *refGenOff);
+int		initRefGenomeAccess(char *fileName);
+void		finalizeRefGenomeAccess();
+int		getRefGenomeContig(char *name);
+char		*getRefGenomeRange(int contig, int start, int length);
 #endif
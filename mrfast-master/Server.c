@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) <2008 - 2020>, University of Washington, Simon Fraser University, 
+ * Bilkent University and Carnegie Mellon University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice, this
+ *   list of conditions and the following disclaimer in the documentation and/or other
+ *   materials provided with the distribution.
+ * - Neither the names of the University of Washington, Simon Fraser University, 
+ *   Bilkent University, Carnegie Mellon University,
+ *   nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+  Authors: 
+  Farhad Hormozdiari
+	  farhadh AT uw DOT edu
+  Faraz Hach
+	  fhach AT cs DOT sfu DOT ca
+  Can Alkan
+	  calkan AT gmail DOT com
+  Hongyi Xin
+	  gohongyi AT gmail DOT com
+  Donghyuk Lee
+	  bleups AT gmail DOT com
+*/
+
+
+
+#define _GNU_SOURCE			// struct ucred
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "Common.h"
+#include "HashTable.h"
+#include "Server.h"
+
+#define SERVER_MAX_JOB		65536		// Bytes of a job: working directory and arguments
+
+// A job is the working directory of the client followed by its search
+// arguments, all NUL terminated, behind their total length. The output of
+// the search streams back as text; a NUL and the exit status end it.
+
+char		*_srv_socketName	= NULL;
+int		_srv_conn		= -1;		// Client of the job run by this process
+char		_srv_status		= 1;
+char		*_srv_options[] = {"--serve", "--client", "--search", "--index", "--hugepages", "--numa",
+				   "-s", "-i", "-I", "-L", "-K", "-N", NULL};
+
+/**********************************************/
+void stopServer(int sig)
+{
+  unlink(_srv_socketName);
+  _exit(0);
+}
+/**********************************************/
+int openServerSocket(char *socketName, struct sockaddr_un *addr)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (fd < 0 || strlen(socketName) >= sizeof(addr->sun_path))
+    {
+      fprintf(stderr, "Error: Cannot use the socket %s\n", socketName);
+      return -1;
+    }
+  strcpy(addr->sun_path, socketName);
+  return fd;
+}
+/**********************************************/
+int readAll(int fd, void *buf, size_t size)
+{
+  ssize_t n;
+
+  while (size > 0)
+    {
+      n = read(fd, buf, size);
+      if (n <= 0)
+	return 0;
+      buf = (char *)buf + n;
+      size -= n;
+    }
+  return 1;
+}
+/**********************************************/
+int writeAll(int fd, void *buf, size_t size)
+{
+  ssize_t n;
+
+  while (size > 0)
+    {
+      n = write(fd, buf, size);
+      if (n <= 0)
+	return 0;
+      buf = (char *)buf + n;
+      size -= n;
+    }
+  return 1;
+}
+/**********************************************/
+// Ends the output of the job; also reached through the exit() of an error
+void endServerJob()
+{
+  fflush(stdout);
+  fflush(stderr);
+  writeAll(_srv_conn, "", 1);
+  writeAll(_srv_conn, &_srv_status, 1);
+}
+/**********************************************/
+// Jobs run as the user of the server, so only that user may send them
+int isOwnJob(int conn)
+{
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != getuid())
+    {
+      fprintf(stderr, "Error: Rejected a job of another user\n");
+      return 0;
+    }
+  return 1;
+}
+/**********************************************/
+// Runs one job in the forked child: the search sees the job arguments behind
+// --search of the served genome, and its output goes to the client
+int runServerJob(int conn, char *fastaFile, int (*search)(int, char **))
+{
+  char job[SERVER_MAX_JOB+1];
+  char *argv[SERVER_MAX_JOB/2+4];
+  unsigned int len, i;
+  int argc = 3, j;
+  char *p;
+
+  if (!readAll(conn, &len, sizeof(len)) || len > SERVER_MAX_JOB || !readAll(conn, job, len))
+    return 1;
+  job[len] = '\0';
+
+  dup2(conn, STDOUT_FILENO);
+  dup2(conn, STDERR_FILENO);
+  _srv_conn = conn;
+  atexit(endServerJob);
+
+  argv[0] = "mrfast";
+  argv[1] = "--search";
+  argv[2] = fastaFile;
+  for (p = job + strlen(job) + 1, i = p - job; i < len; i += strlen(p) + 1, p = job + i)
+    {
+      for (j = 0; _srv_options[j] != NULL; j++)
+	if (strncmp(p, _srv_options[j], strlen(_srv_options[j])) == 0)
+	  {
+	    fprintf(stderr, "Error: %s cannot be used in a job of the server.\n", _srv_options[j]);
+	    return 1;
+	  }
+      if (strcmp(p, "-") == 0)
+	{
+	  fprintf(stderr, "Error: The standard input cannot be read in a job of the server.\n");
+	  return 1;
+	}
+      argv[argc++] = p;
+    }
+  argv[argc] = NULL;
+
+  if (chdir(job) != 0)
+    {
+      fprintf(stderr, "Error: Cannot change to the directory %s\n", job);
+      return 1;
+    }
+
+  serveSocket = NULL;
+  serveJob = 1;
+  optind = 0;
+  _srv_status = search(argc, argv);
+  return _srv_status;
+}
+/**********************************************/
+// Loads the index of fastaFile once and forks a search against it for every
+// job that arrives on the socket
+int serveIndex(char *socketName, char *fastaFile, int (*search)(int, char **))
+{
+  struct sockaddr_un addr;
+  char path[PATH_MAX];
+  int fd, conn;
+  mode_t mask;
+
+  if (realpath(fastaFile, path) == NULL)
+    {
+      fprintf(stderr, "Error: Cannot find %s\n", fastaFile);
+      return 1;
+    }
+
+  if (!initServingHashTable(fileName[1]))
+    return 1;
+
+  if ((fd = openServerSocket(socketName, &addr)) < 0)
+    return 1;
+  unlink(socketName);
+  mask = umask(077);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0)
+    {
+      fprintf(stderr, "Error: Cannot listen on the socket %s\n", socketName);
+      return 1;
+    }
+  umask(mask);
+
+  _srv_socketName = socketName;
+  signal(SIGCHLD, SIG_IGN);
+  signal(SIGINT, stopServer);
+  signal(SIGTERM, stopServer);
+  fprintf(stderr, "Serving %s on %s\n", fileName[1], socketName);
+
+  while (1)
+    {
+      conn = accept(fd, NULL, NULL);
+      if (conn < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  fprintf(stderr, "Error: Cannot accept a job on the socket %s\n", socketName);
+	  break;
+	}
+
+      if (fork() == 0)
+	{
+	  // A signal to the job must not remove the socket of the server
+	  signal(SIGINT, SIG_DFL);
+	  signal(SIGTERM, SIG_DFL);
+	  signal(SIGCHLD, SIG_DFL);
+	  close(fd);
+	  if (!isOwnJob(conn))
+	    exit(1);
+	  exit(runServerJob(conn, path, search));
+	}
+      close(conn);
+    }
+
+  unlink(socketName);
+  return 1;
+}
+/**********************************************/
+// Sends the arguments, without --client, to the server and relays the output
+// of the search
+int runClient(char *socketName, int argc, char *argv[])
+{
+  struct sockaddr_un addr;
+  char job[SERVER_MAX_JOB];
+  char buf[4096];
+  unsigned int len;
+  int fd, i, n, k;
+
+  if (getcwd(job, sizeof(job)) == NULL)
+    {
+      fprintf(stderr, "Error: Cannot get the working directory\n");
+      return 1;
+    }
+  len = strlen(job) + 1;
+
+  for (i = 1; i < argc; i++)
+    {
+      if (strcmp(argv[i], "--client") == 0)
+	{
+	  i++;
+	  continue;
+	}
+      if (strncmp(argv[i], "--client=", 9) == 0)
+	continue;
+      if (len + strlen(argv[i]) + 1 > SERVER_MAX_JOB)
+	{
+	  fprintf(stderr, "Error: The arguments are too long for the server\n");
+	  return 1;
+	}
+      strcpy(job + len, argv[i]);
+      len += strlen(argv[i]) + 1;
+    }
+
+  if ((fd = openServerSocket(socketName, &addr)) < 0)
+    return 1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+      fprintf(stderr, "Error: No server is listening on %s\n", socketName);
+      return 1;
+    }
+
+  if (!writeAll(fd, &len, sizeof(len)) || !writeAll(fd, job, len))
+    {
+      fprintf(stderr, "Error: Cannot send the job to the server\n");
+      return 1;
+    }
+
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+      for (k = 0; k < n && buf[k] != '\0'; k++);
+      fwrite(buf, 1, k, stderr);
+      if (k < n)
+	{
+	  // The exit status follows the NUL
+	  if (k + 1 < n)
+	    return buf[k+1];
+	  return (read(fd, buf, 1) == 1) ? buf[0] : 1;
+	}
+    }
+
+  fprintf(stderr, "Error: The server ended the job unexpectedly\n");
+  return 1;
+}
@@ -57,16 +57,46 @@
 #include "Output.h"
 #include "HashTable.h"
 #include "MrFAST.h"
+#include "IndexStats.h"
+#include "IndexPatch.h"
+#include "Server.h"
 
 char 			*versionNumber = "2.6";			// Current Version
 unsigned char		seqFastq;
 
-int main(int argc, char *argv[])
+int runMrFAST(int argc, char *argv[])
 {
   if (!parseCommandLine(argc, argv))
     return 1;
 
+  if (clientSocket != NULL)
+    return runClient(clientSocket, argc, argv);
+
   configHashTable();
+  /****************************************************
+   * SERVER
+   ***************************************************/
+  if (serveSocket != NULL)
+    {
+      return serveIndex(serveSocket, fileName[0], &runMrFAST);
+    }
+  /****************************************************
+   * INDEX STATISTICS
+   ***************************************************/
+  if (indexStatsMode)
+    {
+      return (printIndexStats(fileName[1], seqFile1, indexStatsTop)) ? 0 : 1;
+    }
+  /****************************************************
+   * INDEX PATCHING
+   ***************************************************/
+  if (indexPatchMode)
+    {
+      char patchIndexName[FILE_NAME_LENGTH];
+
+      snprintf(patchIndexName, FILE_NAME_LENGTH, "%s.index", patchName);
+      return (patchIndex(fileName[1], patchVcf, patchIndexName)) ? 0 : 1;
+    }
   /****************************************************
    * INDEXING
    ***************************************************/
@@ -75,6 +105,8 @@ int main(int argc, char *argv[])
       /********************************
        * Regular Mode
        ********************************/
+      if (indexAppendMode && !initAppendingHashTable(fileName[1]))
+	return 1;
       configHashTable();
       generateHashTable(fileName[0], fileName[1]);
     }
@@ -95,6 +127,7 @@ int main(int argc, char *argv[])
       double mappingTime;
       double lstartTime;
       double ppTime = 0.0;
+      double setupTime = 0.0;
       double tmpTime;;
       char *prevGen = getMem(CONTIG_NAME_SIZE);
       prevGen[0]='\0';
@@ -146,6 +179,11 @@ int main(int argc, char *argv[])
       // Preparing output
       initOutput(outputFileName, outCompressed);
 
+      if (indexHugePages)
+	fprintf(stderr, "Index memory backed by hugepages.\n");
+      if (numaNodeMask)
+	fprintf(stderr, "Index memory %s NUMA nodes 0x%lx.\n", (__builtin_popcountl(numaNodeMask) > 1) ? "interleaved over" : "bound to", numaNodeMask);
+
       fprintf(stderr, "-----------------------------------------------------------------------------------------------------------\n");
       fprintf(stderr, "| %15s | %15s | %15s | %15s | %15s %15s |\n","Seq. Name","Loading Time", "Mapping Time", "Memory Usage(M)","Total Mappings","Mapped reads");
       fprintf(stderr, "-----------------------------------------------------------------------------------------------------------\n");
@@ -159,10 +197,12 @@ int main(int argc, char *argv[])
 	  if(bestMode)
 	    initBestMapping(seqListSize);
 
+	  setupTime = getTime();
 	  if (!initLoadingHashTable(fileName[1]))
 	    {
 	      return 1;
 	    }
+	  setupTime = getTime() - setupTime;
 							
 	  mappingTime = 0;
 	  loadingTime = 0;
@@ -244,10 +284,12 @@ int main(int argc, char *argv[])
 	  if(pairedEndMode)
 	    initBestMapping(seqListSize);
 
+	  setupTime = getTime();
 	  if (!initLoadingHashTable(fileName[1]))
 	    {
 	      return 1;
 	    }
+	  setupTime = getTime() - setupTime;
 	  mappingTime = 0;
 	  loadingTime = 0;
 	  prevGen[0] = '\0';
@@ -339,10 +381,12 @@ int main(int argc, char *argv[])
       fprintf(stderr, "%19s%16.2f%18.2f\n\n", "Total:",totalLoadingTime, totalMappingTime);
       if (pairedEndDiscordantMode)
 	fprintf(stderr, "Post Processing Time: %18.2f \n", ppTime);
+      fprintf(stderr, "%-30s%10.2f\n","Index Setup Time:", setupTime);
       fprintf(stderr, "%-30s%10.2f\n","Total Time:", totalMappingTime+totalLoadingTime);
       fprintf(stderr, "%-30s%10d\n","Total No. of Reads:", seqListSize);
       fprintf(stderr, "%-30s%10lld\n","Total No. of Mappings:", mappingCnt);
-      fprintf(stderr, "%-30s%10.0f\n\n","Avg No. of locations verified:", ceil((float)verificationCnt/seqListSize));
+      fprintf(stderr, "%-30s%10.0f\n","Avg No. of locations verified:", ceil((float)verificationCnt/seqListSize));
+      fprintf(stderr, "%-30s%10lld\n\n","No. of skipped candidates:", skippedCandidateCnt);
 
       int cof = (pairedEndMode)?2:1;
 
@@ -374,3 +418,8 @@ int main(int argc, char *argv[])
 
   return 0;
 }
+/**********************************************/
+int main(int argc, char *argv[])
+{
+  return runMrFAST(argc, argv);
+}